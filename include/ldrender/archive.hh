@@ -0,0 +1,56 @@
+// codeshaunted - ldrender
+// include/ldrender/archive.hh
+// contains Archive declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_ARCHIVE_HH
+#define LDRENDER_ARCHIVE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ldrender {
+
+// read only view of a ZIP file (such as complete.zip), mapped once and indexed by normalized entry name
+class Archive {
+    public:
+        Archive();
+        ~Archive();
+        bool open(const std::string& file_path);
+        bool contains(const std::string& name);
+        bool read(const std::string& name, std::string& data); // safe to call from several threads at once
+        static std::string normalizeName(const std::string& name); // lowercase, forward slashes, no leading ldraw/
+    private:
+        struct Entry {
+            uint16_t method;
+            uint32_t compressed_size;
+            uint32_t uncompressed_size;
+            uint32_t local_header_offset;
+        };
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        bool is_mapped = false;
+        std::vector<unsigned char> buffer; // used instead of a mapping where mmap isn't available
+        std::unordered_map<std::string, Entry> entries;
+        void close();
+        bool readCentralDirectory();
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_ARCHIVE_HH
@@ -0,0 +1,69 @@
+// codeshaunted - ldrender
+// include/ldrender/engine.hh
+// contains Engine declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_ENGINE_HH
+#define LDRENDER_ENGINE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image.hh"
+#include "ldraw.hh"
+#include "renderer.hh"
+
+namespace ldrender {
+
+struct RenderJob {
+    LDraw* model = nullptr; // an already loaded root model, otherwise model_data or model_path is loaded and freed again
+    std::string model_path;
+    std::string model_data; // LDraw or MPD text, used instead of model_path when not empty
+    int width = 1920;
+    int height = 1080;
+    float offset_x = 50.0f;
+    float offset_y = 250.0f;
+    bool visibility = false;
+    bool flat_shading = false;
+    uint32_t* pixels = nullptr; // width * height colors, top down, owned by the caller
+    uint32_t* ids = nullptr; // optional width * height primitive ids, implies visibility
+};
+
+// loads the library once and renders any number of models into caller owned buffers
+// the library and model registry live in LDraw and are shared by the whole process, so Engines only
+// coexist when they use the same library, one for a different library isn't ready until the others are gone
+class Engine {
+    public:
+        Engine(std::string library_path);
+        ~Engine(); // unloads the library unless another Engine or a root model still uses it
+        bool isReady(); // false if a different library was in use, every render then fails
+        bool render(const RenderJob& job); // may be called from several threads, only loading is serialized
+        std::vector<bool> renderBatch(const std::vector<RenderJob>& jobs, unsigned int thread_count = 0); // 0 uses every hardware thread
+        bool renderTiled(const RenderJob& job, size_t memory_budget, BMPWriter& output, BMPWriter* id_output = nullptr); // pixels and ids are ignored, rows are streamed to output
+    private:
+        std::string library_path;
+        bool ready;
+        static std::mutex load_mutex; // loads from every Engine are serialized since they share the model registry
+        std::unique_ptr<Renderer> prepare(const RenderJob& job);
+        bool renderWithThreads(const RenderJob& job, unsigned int thread_count);
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_ENGINE_HH
@@ -0,0 +1,72 @@
+// codeshaunted - ldrender
+// include/ldrender/file_reader.hh
+// contains FileReader declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_FILE_READER_HH
+#define LDRENDER_FILE_READER_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ldrender {
+
+struct FileReadResult {
+    size_t tag = 0;
+    bool found = false;
+    std::string path; // the candidate path that was read
+    std::string data;
+    std::filesystem::file_time_type write_time;
+};
+
+// reads whole files in the background, either through io_uring or a pool of blocking reader threads
+class FileReader {
+    public:
+        FileReader(bool use_io_uring, unsigned int thread_count); // falls back to the thread pool if io_uring can't be set up
+        ~FileReader();
+        bool isUsingIOUring();
+        void submit(size_t tag, std::vector<std::string> candidate_paths); // reads the first candidate that can be opened
+        bool next(FileReadResult& result); // waits for the next finished read, false once every submitted read was released
+        void release(); // marks a result from next() as handled, submit any follow up reads before calling this
+    private:
+        struct Request {
+            size_t tag;
+            std::vector<std::string> candidate_paths;
+        };
+        struct IOUringQueue;
+        std::mutex mutex;
+        std::condition_variable request_condition;
+        std::condition_variable result_condition;
+        std::deque<Request> requests;
+        std::deque<FileReadResult> results;
+        size_t pending = 0; // submitted but not released yet
+        bool stopping = false;
+        IOUringQueue* uring = nullptr;
+        std::vector<std::thread> threads;
+        bool takeRequest(Request& request, bool wait);
+        void finish(FileReadResult result);
+        void runThreadPool();
+        void runIOUring();
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_FILE_READER_HH
@@ -0,0 +1,70 @@
+// codeshaunted - ldrender
+// include/ldrender/image.hh
+// contains Image declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_IMAGE_HH
+#define LDRENDER_IMAGE_HH
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ldrender {
+
+// streams rows into a BMP file so the whole image never has to be in memory
+class BMPWriter {
+    public:
+        bool open(const std::string& file_name, int width, int height, int bits_per_pixel = 24); // 24 = rgb, 32 = raw value per pixel
+        bool writeRow(const uint32_t* row); // BMP is stored bottom up, so rows must be written from the last to the first
+        bool close();
+        static bool writeImage(const std::string& file_name, int width, int height, const uint32_t* pixels, int bits_per_pixel = 24); // pixels are top down
+    private:
+        std::ofstream file;
+        int width = 0;
+        int bytes_per_pixel = 0;
+        std::vector<char> row_buffer;
+};
+
+// an image can also cover only a band of rows of a larger image, starting at origin_y
+class Image {
+    public:
+        Image(int width, int height, uint32_t clear_value = 0, int origin_y = 0);
+        Image(uint32_t* pixels, int width, int height, uint32_t clear_value = 0); // draws straight into a caller owned buffer of width * height pixels
+        int getWidth();
+        int getHeight();
+        int getOriginY();
+        uint32_t* getPixels();
+        void clear(uint32_t clear_value, int origin_y = 0);
+        void setPixel(int x, int y, float z, uint32_t value); // depth tested write
+        void flushProfileCounters(); // hands the pixel counters to the Profiler and resets them, also decides whether the next pass counts
+        bool saveBMP(const std::string& file_name, int bits_per_pixel = 24);
+    private:
+        int width;
+        int height;
+        int origin_y;
+        std::vector<float> depth_buffer;
+        std::vector<uint32_t> owned_pixels; // empty when drawing into a caller owned buffer
+        uint32_t* pixels;
+        bool count_pixels; // captured from the Profiler once per pass so setPixel doesn't count when profiling is off
+        uint64_t pixels_tested = 0;
+        uint64_t pixels_written = 0;
+        uint64_t pixels_overwritten = 0;
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_IMAGE_HH
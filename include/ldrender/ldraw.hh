@@ -18,8 +18,12 @@
 #ifndef LDRENDER_LDRAW_HH
 #define LDRENDER_LDRAW_HH
 
+#include <filesystem>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace ldrender {
@@ -42,6 +46,7 @@ class TransformMatrix {
         float data[4][4];
 };
 
+class Archive;
 class LDraw;
 
 struct LDrawColor {
@@ -82,29 +87,97 @@ struct LDrawOptLine {
 
 };
 
+// where a flattened primitive came from, so primitive ids can be mapped back to part instances
+struct LDrawPrimitiveSource {
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    uint32_t submodel; // index into LDrawSourceTable::names, the model holding the part reference
+    uint32_t instance; // tells apart placements of a submodel that is used more than once, counted from 0
+    uint32_t part; // index into LDrawSourceTable::names, NONE if the primitive belongs to the submodel itself
+    uint32_t reference; // which type 1 line of the submodel placed the part, counted from 0, NONE without a part
+};
+
+struct LDrawSourceTable {
+    std::vector<std::string> names;
+    std::vector<LDrawPrimitiveSource> primitives; // indexed by primitive id, lines first, then tris, then quads
+};
+
+enum class LoaderType {
+    SERIAL, // read and parse one file at a time
+    THREAD_POOL, // pipelined, files are read by a pool of blocking reader threads
+    IO_URING // pipelined, files are read through io_uring, falls back to THREAD_POOL if unavailable
+};
+
 class LDraw {
     public:
-        LDraw(std::string library_path);
-        ~LDraw();
+        LDraw(std::string library_path); // loads the library through loadLibrary, the model stays empty if that fails
+        ~LDraw(); // frees the models this root created unless another root still uses them, library parts stay cached
         bool wasLoaded();
-        void loadFromData(std::string model_data);
+        bool wasFound(); // false if loadFromFile couldn't find the file or the library couldn't be loaded
+        void loadFromData(std::string model_data); // only parses, call loadPendingModels to load the files it references
         void loadFromFile(std::string file_path);
+        void loadPendingModels();
+        bool reload(); // re-parses only the models whose file sections changed on disk, returns true if anything changed
+        static void setLoaderType(LoaderType loader_type);
+        // library_path may also be a ZIP archive such as complete.zip, it is only loaded again when it changes, fails if it is
+        // a file that can't be opened as an archive or while another library is in use, pair every success with releaseLibrary
+        static bool loadLibrary(const std::string& library_path);
+        static void releaseLibrary();
+        static bool unloadLibrary(); // frees cached parts and colors, fails while the library is in use
+        static size_t getLoadedFileCount(); // model files currently read from disk, library parts included
         std::vector<LDrawLine> buildLines();
         std::vector<LDrawTri> buildTris();
         std::vector<LDrawQuad> buildQuads();
+        LDrawSourceTable buildSourceTable(); // matches the order of the build* results, models found in the library count as parts
     private:
         bool was_loaded = false;
         bool is_root_model = false;
+        bool has_library = true; // false for a root model whose loadLibrary failed
+        bool from_file = false; // loaded by name rather than as a section of another file
+        bool is_library_part = false; // found in the library rather than next to the model, kept between root models
+        LDraw* owner = nullptr; // root model that created this one, nullptr for roots and models that outlived theirs
+        std::string name;
+        std::string source_path; // file this model was read from, empty if it was never found
+        size_t content_hash = 0; // hash of the section this model was parsed from
         static std::string library_path;
+        static bool library_loaded;
+        static size_t library_users; // root models and embedders between loadLibrary and releaseLibrary
+        static LoaderType loader_type;
+        static Archive* library_archive; // nullptr when the library is a directory
+        static std::mutex models_mutex; // guards the static maps and was_loaded while the pipelined loader runs
         static std::unordered_map<std::string, LDraw*> loaded_models;
+        static std::unordered_set<LDraw*> root_models; // live roots holding the library, what they reach is never freed by another root
         static std::unordered_map<int, LDrawColor*> color_map;
+        static std::unordered_map<std::string, LDraw*> file_models; // resolved path -> model loaded from it
+        static std::unordered_map<std::string, std::filesystem::file_time_type> file_times;
         std::vector<LDrawSubFile> subfiles;
         std::vector<LDrawLine> lines;
         std::vector<LDrawTri> tris;
         std::vector<LDrawQuad> quads;
         std::vector<LDrawOptLine> optlines;
+        // flattened geometry, kept until this model or one of its subfiles changes
+        bool lines_built = false;
+        bool tris_built = false;
+        bool quads_built = false;
+        std::vector<LDrawLine> built_lines;
+        std::vector<LDrawTri> built_tris;
+        std::vector<LDrawQuad> built_quads;
         LDraw();
-        void loadLDConfig();
+        static void loadLDConfig();
+        // returns the models that were (re)parsed, with claimed_models a section another thread already took is skipped
+        std::vector<LDraw*> loadSections(const std::string& model_data, bool skip_unchanged, std::unordered_set<LDraw*>* claimed_models = nullptr);
+        void parseSection(const std::string& section_data);
+        void clearGeometry();
+        void invalidateBuild();
+        const std::vector<LDrawLine>& getBuiltLines();
+        const std::vector<LDrawTri>& getBuiltTris();
+        const std::vector<LDrawQuad>& getBuiltQuads();
+        size_t getBuiltCount(int line_type); // 2 = lines, 3 = tris, 4 = quads
+        void appendSources(int line_type, LDrawSourceTable& table, std::unordered_map<LDraw*, uint32_t>& name_indices, std::unordered_map<LDraw*, uint32_t>& instance_counts);
+        static LDraw* getOrCreateModel(const std::string& name, LDraw* owner, bool mark_loaded = false);
+        static std::vector<std::string> getCandidatePaths(const std::string& file_name);
+        static bool readModelFile(const std::string& file_name, std::string& data, std::string& resolved_path);
+        static bool readArchiveModel(const std::string& file_name, std::string& data, std::string& resolved_path);
+        static std::vector<std::pair<std::string, std::string>> splitSections(const std::string& model_data);
 };
 
 } // namespace ldrender
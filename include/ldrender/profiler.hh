@@ -0,0 +1,72 @@
+// codeshaunted - ldrender
+// include/ldrender/profiler.hh
+// contains Profiler declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_PROFILER_HH
+#define LDRENDER_PROFILER_HH
+
+#include <cstdint>
+#include <string>
+
+namespace ldrender {
+
+enum class ProfileCounter {
+    FILES_OPENED,
+    FILES_FAILED, // failed open attempts, one file can fail on several candidate paths
+    ARCHIVE_ENTRIES_READ,
+    BYTES_READ,
+    LINES_PARSED, // lines of LDraw text
+    SUBFILE_PRIMITIVES,
+    LINE_PRIMITIVES,
+    TRI_PRIMITIVES,
+    QUAD_PRIMITIVES,
+    PIXELS_TESTED, // depth tests inside the image
+    PIXELS_WRITTEN, // depth tests that passed
+    PIXELS_OVERWRITTEN, // passed depth tests on pixels that were already written
+    COUNT
+};
+
+// everything is a no-op until enabled, counters are atomic and timed scopes go to per thread buffers
+class Profiler {
+    public:
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+        static void reset(); // drops every event and counter, nothing may be profiled while this runs
+        static void addCounter(ProfileCounter counter, uint64_t value);
+        static uint64_t getCounter(ProfileCounter counter);
+        static bool writeReport(const std::string& file_name); // per phase totals and counters as JSON
+        static bool writeTrace(const std::string& file_name); // per thread timeline in Chrome trace format
+    private:
+        friend class ProfileScope;
+        static bool enabled;
+        static uint64_t now(); // nanoseconds since the profiler was enabled
+        static void addEvent(const char* name, uint64_t start, uint64_t end);
+};
+
+// times the enclosing scope, name must outlive the profiler (string literals)
+class ProfileScope {
+    public:
+        ProfileScope(const char* name);
+        ~ProfileScope();
+    private:
+        const char* name;
+        uint64_t start;
+        bool active;
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_PROFILER_HH
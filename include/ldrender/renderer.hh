@@ -0,0 +1,59 @@
+// codeshaunted - ldrender
+// include/ldrender/renderer.hh
+// contains Renderer declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_RENDERER_HH
+#define LDRENDER_RENDERER_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "image.hh"
+#include "ldraw.hh"
+
+namespace ldrender {
+
+// primitive ids are assigned in draw order: lines first, then tris, then quads
+class Renderer {
+    public:
+        static constexpr uint32_t NO_PRIMITIVE = 0xFFFFFFFF;
+        Renderer(std::vector<LDrawLine> lines, std::vector<LDrawTri> tris, std::vector<LDrawQuad> quads);
+        void translate(float x, float y);
+        void setFlatShading(bool flat_shading);
+        void setThreadCount(unsigned int thread_count);
+        size_t getPrimitiveCount();
+        void renderForward(Image& image); // writes final colors per covered pixel
+        void renderVisibility(Image& image); // writes primitive ids only, image should be cleared to NO_PRIMITIVE
+        void resolve(const uint32_t* ids, uint32_t* colors, size_t count); // maps visible ids to colors in parallel, may be done in place
+        bool renderTiled(int width, int height, size_t memory_budget, bool visibility, BMPWriter& output, BMPWriter* id_output = nullptr); // renders in bands of rows that fit in memory_budget bytes and streams them out, culling needs another 8 bytes per primitive
+    private:
+        std::vector<LDrawLine> lines;
+        std::vector<LDrawTri> tris;
+        std::vector<LDrawQuad> quads;
+        std::vector<uint32_t> palette; // final color per primitive id
+        bool flat_shading = false;
+        unsigned int thread_count;
+        void buildPalette();
+        void rasterize(Image& image, bool write_ids);
+        void rasterizePrimitive(Image& image, uint32_t id, bool write_ids);
+        void getPrimitiveRows(uint32_t id, int& min_y, int& max_y);
+        void drawLine(Image& image, const Vector3& position1, const Vector3& position2, uint32_t value);
+        void fillTriangle(Image& image, const Vector3& position1, const Vector3& position2, const Vector3& position3, uint32_t value);
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_RENDERER_HH
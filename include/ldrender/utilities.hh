@@ -18,6 +18,7 @@
 #ifndef LDRENDER_UTILITIES_HH
 #define LDRENDER_UTILITIES_HH
 
+#include <charconv>
 #include <string>
 #include <vector>
 
@@ -28,8 +29,18 @@ class Utilities {
         static std::string toLowercaseString(const std::string& string);
         static std::string trimString(const std::string& string);
         static std::vector<std::string> splitStringByWhitespace(const std::string& string, int max_splits = -1);
+        template <typename T>
+        static bool parseNumber(const std::string& string, T& value); // false unless the whole string is a number that fits T
 };
 
+template <typename T>
+bool Utilities::parseNumber(const std::string& string, T& value) {
+    const char* end = string.data() + string.size();
+    auto [pointer, error] = std::from_chars(string.data(), end, value);
+
+    return error == std::errc() && pointer == end;
+}
+
 } // namespace ldrender
 
 #endif // LDRENDER_UTILITIES_HH
\ No newline at end of file
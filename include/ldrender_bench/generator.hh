@@ -0,0 +1,55 @@
+// codeshaunted - ldrender
+// include/ldrender_bench/generator.hh
+// contains synthetic LDraw generator declarations
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#ifndef LDRENDER_BENCH_GENERATOR_HH
+#define LDRENDER_BENCH_GENERATOR_HH
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+namespace ldrender {
+
+struct GeneratorOptions {
+    int part_count = 500; // files in parts/
+    int nesting_depth = 3; // levels of p/ files between a part and the geometry
+    int files_per_level = 50; // p/ files on each nesting level
+    int triangles_per_file = 24; // triangle density of the innermost files
+    int submodel_count = 20; // 0 FILE sections in the generated MPD
+    int parts_per_submodel = 100;
+    unsigned int seed = 1;
+};
+
+// writes a self contained library (LDConfig.ldr, parts/, p/) and MPD models that only use it
+class Generator {
+    public:
+        Generator(GeneratorOptions options);
+        bool writeLibrary(const std::filesystem::path& library_path);
+        std::string generateModel(int width, int height); // parts are spread over roughly width x height pixels
+    private:
+        GeneratorOptions options;
+        std::mt19937 random;
+        float randomFloat(float min, float max);
+        std::string generateConfig();
+        std::string generateGeometryFile();
+        std::string generateReferenceFile(int level);
+        std::string generatePart();
+};
+
+} // namespace ldrender
+
+#endif // LDRENDER_BENCH_GENERATOR_HH
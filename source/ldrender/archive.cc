@@ -0,0 +1,241 @@
+// codeshaunted - ldrender
+// source/ldrender/archive.cc
+// contains Archive definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "archive.hh"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "profiler.hh"
+#include "utilities.hh"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef LDRENDER_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace ldrender {
+
+static uint16_t readUInt16(const unsigned char* data) {
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t readUInt32(const unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+Archive::Archive() {
+
+}
+
+Archive::~Archive() {
+    this->close();
+}
+
+bool Archive::open(const std::string& file_path) {
+    this->close();
+
+#ifndef _WIN32
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    this->data = static_cast<const unsigned char*>(mapping);
+    this->size = file_stat.st_size;
+    this->is_mapped = true;
+#else
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.good()) {
+        return false;
+    }
+    this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    this->data = this->buffer.data();
+    this->size = this->buffer.size();
+#endif
+
+    if (!this->readCentralDirectory()) {
+        this->close();
+        return false;
+    }
+
+    return true;
+}
+
+bool Archive::contains(const std::string& name) {
+    return this->entries.contains(Archive::normalizeName(name));
+}
+
+bool Archive::read(const std::string& name, std::string& data) {
+    ProfileScope scope("archive_read");
+
+    auto entry_iterator = this->entries.find(Archive::normalizeName(name));
+    if (entry_iterator == this->entries.end()) {
+        return false;
+    }
+    const Entry& entry = entry_iterator->second;
+
+    // the local header repeats the name and has its own extra field length
+    if (static_cast<size_t>(entry.local_header_offset) + 30 > this->size) {
+        return false;
+    }
+    const unsigned char* local_header = this->data + entry.local_header_offset;
+    if (readUInt32(local_header) != 0x04034B50) {
+        return false;
+    }
+    size_t data_offset = static_cast<size_t>(entry.local_header_offset) + 30 + readUInt16(local_header + 26) + readUInt16(local_header + 28);
+    if (data_offset + entry.compressed_size > this->size) {
+        return false;
+    }
+    const unsigned char* compressed_data = this->data + data_offset;
+
+    if (entry.method == 0) { // stored
+        data.assign(reinterpret_cast<const char*>(compressed_data), entry.compressed_size);
+        Profiler::addCounter(ProfileCounter::ARCHIVE_ENTRIES_READ, 1);
+        Profiler::addCounter(ProfileCounter::BYTES_READ, data.size());
+        return true;
+    }
+
+#ifdef LDRENDER_HAS_ZLIB
+    if (entry.method == 8) { // deflate
+        data.resize(entry.uncompressed_size);
+
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) { // raw deflate, ZIP has no zlib header
+            return false;
+        }
+        stream.next_in = const_cast<Bytef*>(compressed_data);
+        stream.avail_in = entry.compressed_size;
+        stream.next_out = reinterpret_cast<Bytef*>(data.data());
+        stream.avail_out = entry.uncompressed_size;
+        int result = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (result != Z_STREAM_END || stream.total_out != entry.uncompressed_size) {
+            return false;
+        }
+
+        Profiler::addCounter(ProfileCounter::ARCHIVE_ENTRIES_READ, 1);
+        Profiler::addCounter(ProfileCounter::BYTES_READ, data.size());
+        return true;
+    }
+#endif
+
+    return false; // unsupported compression
+}
+
+std::string Archive::normalizeName(const std::string& name) {
+    std::string normalized_name = Utilities::toLowercaseString(name);
+    for (char& c : normalized_name) {
+        if (c == '\\') {
+            c = '/';
+        }
+    }
+
+    if (normalized_name.starts_with("ldraw/")) {
+        normalized_name.erase(0, 6);
+    }
+
+    return normalized_name;
+}
+
+void Archive::close() {
+#ifndef _WIN32
+    if (this->is_mapped) {
+        munmap(const_cast<unsigned char*>(this->data), this->size);
+    }
+#endif
+    this->data = nullptr;
+    this->size = 0;
+    this->is_mapped = false;
+    this->buffer.clear();
+    this->entries.clear();
+}
+
+bool Archive::readCentralDirectory() {
+    // the end of central directory record sits at the very end, followed by a comment of up to 64k
+    if (this->size < 22) {
+        return false;
+    }
+    size_t search_end = this->size > 22 + 0xFFFF ? this->size - 22 - 0xFFFF : 0;
+    size_t end_offset = this->size - 22;
+    while (readUInt32(this->data + end_offset) != 0x06054B50) {
+        if (end_offset == search_end) {
+            return false;
+        }
+        --end_offset;
+    }
+
+    const unsigned char* end_record = this->data + end_offset;
+    uint16_t entry_count = readUInt16(end_record + 10);
+    uint32_t directory_offset = readUInt32(end_record + 16);
+    if (entry_count == 0xFFFF || directory_offset == 0xFFFFFFFF) {
+        return false; // ZIP64, not supported
+    }
+
+    this->entries.reserve(entry_count);
+    size_t offset = directory_offset;
+    for (uint16_t i = 0; i < entry_count; ++i) {
+        if (offset + 46 > this->size || readUInt32(this->data + offset) != 0x02014B50) {
+            return false;
+        }
+        const unsigned char* header = this->data + offset;
+        uint16_t flags = readUInt16(header + 8);
+        uint16_t name_length = readUInt16(header + 28);
+        uint16_t extra_length = readUInt16(header + 30);
+        uint16_t comment_length = readUInt16(header + 32);
+        if (offset + 46 + name_length > this->size) {
+            return false;
+        }
+
+        std::string name(reinterpret_cast<const char*>(header + 46), name_length);
+        bool is_directory = !name.empty() && name.back() == '/';
+        bool is_encrypted = flags & 1;
+        if (!is_directory && !is_encrypted) {
+            Entry entry;
+            entry.method = readUInt16(header + 10);
+            entry.compressed_size = readUInt32(header + 20);
+            entry.uncompressed_size = readUInt32(header + 24);
+            entry.local_header_offset = readUInt32(header + 42);
+            this->entries.insert({Archive::normalizeName(name), entry});
+        }
+
+        offset += 46 + name_length + extra_length + comment_length;
+    }
+
+    return true;
+}
+
+} // namespace ldrender
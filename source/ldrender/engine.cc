@@ -0,0 +1,159 @@
+// codeshaunted - ldrender
+// source/ldrender/engine.cc
+// contains Engine definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "engine.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "profiler.hh"
+
+namespace ldrender {
+
+std::mutex Engine::load_mutex;
+
+Engine::Engine(std::string library_path) : library_path(library_path) {
+    std::lock_guard<std::mutex> lock(Engine::load_mutex);
+
+    // loads colors and opens the archive, parts are cached as jobs need them
+    this->ready = LDraw::loadLibrary(library_path);
+}
+
+Engine::~Engine() {
+    std::lock_guard<std::mutex> lock(Engine::load_mutex);
+
+    if (this->ready) {
+        LDraw::releaseLibrary();
+        LDraw::unloadLibrary();
+    }
+}
+
+bool Engine::isReady() {
+    return this->ready;
+}
+
+bool Engine::render(const RenderJob& job) {
+    return this->renderWithThreads(job, 0);
+}
+
+std::vector<bool> Engine::renderBatch(const std::vector<RenderJob>& jobs, unsigned int thread_count) {
+    ProfileScope scope("render_batch");
+
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    unsigned int worker_count = std::min<size_t>(thread_count, std::max<size_t>(jobs.size(), 1));
+    unsigned int renderer_thread_count = std::max(1u, thread_count / worker_count);
+
+    // one flag per job instead of std::vector<bool>, which can't be written from several threads
+    std::vector<char> results(jobs.size(), 0);
+    std::atomic<size_t> next_job = 0;
+    auto work = [&]() {
+        for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            results[i] = this->renderWithThreads(jobs[i], renderer_thread_count);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < worker_count; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    return std::vector<bool>(results.begin(), results.end());
+}
+
+bool Engine::renderTiled(const RenderJob& job, size_t memory_budget, BMPWriter& output, BMPWriter* id_output) {
+    if (job.width <= 0 || job.height <= 0) {
+        return false;
+    }
+
+    std::unique_ptr<Renderer> renderer = this->prepare(job);
+    if (!renderer) {
+        return false;
+    }
+
+    return renderer->renderTiled(job.width, job.height, memory_budget, job.visibility || id_output, output, id_output);
+}
+
+std::unique_ptr<Renderer> Engine::prepare(const RenderJob& job) {
+    std::lock_guard<std::mutex> lock(Engine::load_mutex);
+
+    if (!this->ready) {
+        return nullptr;
+    }
+
+    std::unique_ptr<Renderer> renderer;
+    if (job.model) {
+        if (!job.model->wasLoaded() || !job.model->wasFound()) {
+            return nullptr;
+        }
+        renderer = std::make_unique<Renderer>(job.model->buildLines(), job.model->buildTris(), job.model->buildQuads());
+    } else {
+        // the root model is freed before rasterizing so the next job can load while this one draws
+        LDraw model(this->library_path);
+        if (!job.model_data.empty()) {
+            model.loadFromData(job.model_data);
+            model.loadPendingModels();
+        } else {
+            model.loadFromFile(job.model_path);
+            if (!model.wasFound()) {
+                return nullptr;
+            }
+        }
+        renderer = std::make_unique<Renderer>(model.buildLines(), model.buildTris(), model.buildQuads());
+    }
+
+    renderer->translate(job.offset_x, job.offset_y);
+    renderer->setFlatShading(job.flat_shading);
+
+    return renderer;
+}
+
+bool Engine::renderWithThreads(const RenderJob& job, unsigned int thread_count) {
+    if (!job.pixels || job.width <= 0 || job.height <= 0) {
+        return false;
+    }
+
+    std::unique_ptr<Renderer> renderer = this->prepare(job);
+    if (!renderer) {
+        return false;
+    }
+    if (thread_count != 0) {
+        renderer->setThreadCount(thread_count);
+    }
+
+    size_t pixel_count = static_cast<size_t>(job.width) * job.height;
+    if (job.visibility || job.ids) {
+        // without an id buffer the ids are resolved in place
+        uint32_t* ids = job.ids ? job.ids : job.pixels;
+        Image image(ids, job.width, job.height, Renderer::NO_PRIMITIVE);
+        renderer->renderVisibility(image);
+        renderer->resolve(ids, job.pixels, pixel_count);
+    } else {
+        Image image(job.pixels, job.width, job.height);
+        renderer->renderForward(image);
+    }
+
+    return true;
+}
+
+} // namespace ldrender
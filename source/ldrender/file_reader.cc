@@ -0,0 +1,474 @@
+// codeshaunted - ldrender
+// source/ldrender/file_reader.cc
+// contains FileReader definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "file_reader.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "profiler.hh"
+
+#ifdef LDRENDER_HAS_IO_URING
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ldrender {
+
+#ifdef LDRENDER_HAS_IO_URING
+
+// minimal io_uring wrapper over the raw syscalls, only ever driven by the single reader thread
+struct FileReader::IOUringQueue {
+    int fd = -1;
+    unsigned int entries = 0;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+    unsigned int to_submit = 0;
+    bool has_statx = false; // statx through the ring, otherwise the reader thread calls fstat itself
+
+    bool setup(unsigned int requested_entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        this->fd = syscall(__NR_io_uring_setup, requested_entries, &params);
+        if (this->fd < 0) {
+            return false;
+        }
+        this->entries = params.sq_entries;
+
+        this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+        }
+
+        this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+        if (this->sq_ring == MAP_FAILED) {
+            return false;
+        }
+        if (single_mmap) {
+            this->cq_ring = this->sq_ring;
+        } else {
+            this->cq_ring = mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+            if (this->cq_ring == MAP_FAILED) {
+                return false;
+            }
+        }
+        this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        this->sqes = (io_uring_sqe*)mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+        if (this->sqes == MAP_FAILED) {
+            return false;
+        }
+
+        char* sq = (char*)this->sq_ring;
+        this->sq_head = (unsigned*)(sq + params.sq_off.head);
+        this->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        this->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        this->sq_array = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)this->cq_ring;
+        this->cq_head = (unsigned*)(cq + params.cq_off.head);
+        this->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        this->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        this->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // openat and read through the ring need a 5.6+ kernel, ask instead of guessing from the version
+        std::vector<char> probe_buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = (io_uring_probe*)probe_buffer.data();
+        if (syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
+        }
+
+        this->has_statx = probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+
+        return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    void destroy() {
+        if (this->sqes != MAP_FAILED) {
+            munmap(this->sqes, this->sqes_size);
+        }
+        if (this->cq_ring != MAP_FAILED && this->cq_ring != this->sq_ring) {
+            munmap(this->cq_ring, this->cq_ring_size);
+        }
+        if (this->sq_ring != MAP_FAILED) {
+            munmap(this->sq_ring, this->sq_ring_size);
+        }
+        if (this->fd >= 0) {
+            close(this->fd);
+        }
+    }
+
+    io_uring_sqe* getSQE() {
+        unsigned int tail = *this->sq_tail;
+        if (tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->entries) {
+            return nullptr;
+        }
+
+        unsigned int index = tail & *this->sq_mask;
+        io_uring_sqe* sqe = &this->sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        this->sq_array[index] = index;
+        __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++this->to_submit;
+
+        return sqe;
+    }
+
+    void submitAndWait() {
+        int result;
+        do {
+            result = syscall(__NR_io_uring_enter, this->fd, this->to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        } while (result < 0 && errno == EINTR);
+        if (result > 0) {
+            this->to_submit -= std::min<unsigned int>(result, this->to_submit);
+        }
+    }
+};
+
+#else
+
+struct FileReader::IOUringQueue {};
+
+#endif
+
+FileReader::FileReader(bool use_io_uring, unsigned int thread_count) {
+#ifdef LDRENDER_HAS_IO_URING
+    if (use_io_uring) {
+        this->uring = new IOUringQueue();
+        if (this->uring->setup(64)) {
+            this->threads.emplace_back(&FileReader::runIOUring, this);
+            return;
+        }
+        this->uring->destroy();
+        delete this->uring;
+        this->uring = nullptr;
+    }
+#endif
+
+    for (unsigned int i = 0; i < std::max(1u, thread_count); ++i) {
+        this->threads.emplace_back(&FileReader::runThreadPool, this);
+    }
+}
+
+FileReader::~FileReader() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->request_condition.notify_all();
+
+    for (std::thread& thread : this->threads) {
+        thread.join();
+    }
+
+#ifdef LDRENDER_HAS_IO_URING
+    if (this->uring) {
+        this->uring->destroy();
+        delete this->uring;
+    }
+#endif
+}
+
+bool FileReader::isUsingIOUring() {
+    return this->uring != nullptr;
+}
+
+void FileReader::submit(size_t tag, std::vector<std::string> candidate_paths) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ++this->pending;
+        this->requests.push_back({tag, std::move(candidate_paths)});
+    }
+    this->request_condition.notify_one();
+}
+
+bool FileReader::next(FileReadResult& result) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->result_condition.wait(lock, [this] { return !this->results.empty() || this->pending == 0; });
+    if (this->results.empty()) {
+        return false;
+    }
+
+    result = std::move(this->results.front());
+    this->results.pop_front();
+
+    return true;
+}
+
+void FileReader::release() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (--this->pending == 0) {
+        this->result_condition.notify_all(); // wake everyone waiting in next() so they can stop
+    }
+}
+
+bool FileReader::takeRequest(Request& request, bool wait) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (wait) {
+        this->request_condition.wait(lock, [this] { return !this->requests.empty() || this->stopping; });
+    }
+    if (this->requests.empty()) {
+        return false;
+    }
+
+    request = std::move(this->requests.front());
+    this->requests.pop_front();
+
+    return true;
+}
+
+void FileReader::finish(FileReadResult result) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->results.push_back(std::move(result));
+    }
+    this->result_condition.notify_one();
+}
+
+void FileReader::runThreadPool() {
+    Request request;
+    while (this->takeRequest(request, true)) {
+        ProfileScope scope("read_file");
+        FileReadResult result;
+        result.tag = request.tag;
+
+        for (const std::string& candidate : request.candidate_paths) {
+            std::ifstream file(candidate, std::ios::binary);
+            if (!file.good()) {
+                Profiler::addCounter(ProfileCounter::FILES_FAILED, 1);
+                continue;
+            }
+            Profiler::addCounter(ProfileCounter::FILES_OPENED, 1);
+
+            std::error_code error;
+            result.write_time = std::filesystem::last_write_time(candidate, error);
+
+            std::stringstream data;
+            data << file.rdbuf();
+            result.data = data.str();
+            result.path = candidate;
+            result.found = true;
+            Profiler::addCounter(ProfileCounter::BYTES_READ, result.data.size());
+            break;
+        }
+
+        this->finish(std::move(result));
+    }
+}
+
+#ifdef LDRENDER_HAS_IO_URING
+
+// every read walks open -> statx -> read (repeated on short reads) -> close, with at most one operation in the ring at a time
+struct PendingRead {
+    enum class Stage {
+        OPEN,
+        STAT,
+        READ
+    };
+    Stage stage = Stage::OPEN;
+    std::vector<std::string> candidate_paths;
+    size_t candidate = 0;
+    int fd = -1;
+    size_t offset = 0;
+    struct statx stat_buffer;
+    FileReadResult result;
+};
+
+static std::filesystem::file_time_type toFileTime(int64_t seconds, uint32_t nanoseconds) {
+    std::chrono::system_clock::duration since_epoch = std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds));
+
+    return std::chrono::file_clock::from_sys(std::chrono::system_clock::time_point(since_epoch));
+}
+
+void FileReader::runIOUring() {
+    IOUringQueue& uring = *this->uring;
+    unsigned int in_flight = 0;
+
+    auto queue_open = [&uring, &in_flight](PendingRead* read) {
+        io_uring_sqe* sqe = uring.getSQE();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)read->candidate_paths[read->candidate].c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = (uint64_t)read;
+        ++in_flight;
+    };
+
+    auto queue_stat = [&uring, &in_flight](PendingRead* read) {
+        read->stage = PendingRead::Stage::STAT;
+        io_uring_sqe* sqe = uring.getSQE();
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = read->fd;
+        sqe->addr = (uint64_t)"";
+        sqe->statx_flags = AT_EMPTY_PATH;
+        sqe->len = STATX_SIZE | STATX_MTIME;
+        sqe->off = (uint64_t)&read->stat_buffer;
+        sqe->user_data = (uint64_t)read;
+        ++in_flight;
+    };
+
+    auto queue_read = [&uring, &in_flight](PendingRead* read) {
+        read->stage = PendingRead::Stage::READ;
+        io_uring_sqe* sqe = uring.getSQE();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = read->fd;
+        sqe->addr = (uint64_t)(read->result.data.data() + read->offset);
+        sqe->len = std::min<size_t>(read->result.data.size() - read->offset, 0x7FFFF000);
+        sqe->off = read->offset;
+        sqe->user_data = (uint64_t)read;
+        ++in_flight;
+    };
+
+    auto complete = [this](PendingRead* read, bool found) {
+        if (read->fd >= 0) {
+            close(read->fd);
+        }
+        read->result.found = found;
+        if (found) {
+            Profiler::addCounter(ProfileCounter::BYTES_READ, read->result.data.size());
+        }
+        this->finish(std::move(read->result));
+        delete read;
+    };
+
+    while (true) {
+        // only block for new work when nothing is in the ring
+        Request request;
+        while (in_flight < uring.entries && this->takeRequest(request, in_flight == 0)) {
+            PendingRead* read = new PendingRead();
+            read->candidate_paths = std::move(request.candidate_paths);
+            read->result.tag = request.tag;
+            if (read->candidate_paths.empty()) {
+                complete(read, false);
+                continue;
+            }
+            queue_open(read);
+        }
+
+        if (in_flight == 0) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->stopping && this->requests.empty()) {
+                return;
+            }
+            continue;
+        }
+
+        {
+            ProfileScope scope("io_uring_wait");
+            uring.submitAndWait();
+        }
+
+        unsigned int head = *uring.cq_head;
+        unsigned int tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            io_uring_cqe* cqe = &uring.cqes[head & *uring.cq_mask];
+            PendingRead* read = (PendingRead*)cqe->user_data;
+            int result = cqe->res;
+            --in_flight;
+
+            if (read->stage == PendingRead::Stage::OPEN) {
+                Profiler::addCounter(result < 0 ? ProfileCounter::FILES_FAILED : ProfileCounter::FILES_OPENED, 1);
+                if (result < 0) {
+                    if (++read->candidate < read->candidate_paths.size()) {
+                        queue_open(read);
+                    } else {
+                        complete(read, false);
+                    }
+                    continue;
+                }
+
+                read->fd = result;
+                read->result.path = read->candidate_paths[read->candidate];
+                if (uring.has_statx) {
+                    queue_stat(read);
+                    continue;
+                }
+
+                // one fstat for both size and write time
+                struct stat file_stat;
+                if (fstat(read->fd, &file_stat) < 0) {
+                    complete(read, false);
+                    continue;
+                }
+                read->result.write_time = toFileTime(file_stat.st_mtim.tv_sec, file_stat.st_mtim.tv_nsec);
+                read->result.data.resize(file_stat.st_size);
+            } else if (read->stage == PendingRead::Stage::STAT) {
+                if (result < 0) {
+                    complete(read, false);
+                    continue;
+                }
+                read->result.write_time = toFileTime(read->stat_buffer.stx_mtime.tv_sec, read->stat_buffer.stx_mtime.tv_nsec);
+                read->result.data.resize(read->stat_buffer.stx_size);
+            }
+
+            if (read->stage != PendingRead::Stage::READ) {
+                if (read->result.data.empty()) {
+                    complete(read, true);
+                } else {
+                    queue_read(read);
+                }
+                continue;
+            }
+
+            // read finished
+            if (result == -EINTR || result == -EAGAIN) {
+                queue_read(read);
+            } else if (result < 0) {
+                complete(read, false);
+            } else if (result == 0) {
+                read->result.data.resize(read->offset); // file shrank while reading
+                complete(read, true);
+            } else {
+                read->offset += result;
+                if (read->offset < read->result.data.size()) {
+                    queue_read(read);
+                } else {
+                    complete(read, true);
+                }
+            }
+        }
+        __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+void FileReader::runIOUring() {}
+
+#endif
+
+} // namespace ldrender
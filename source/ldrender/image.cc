@@ -0,0 +1,182 @@
+// codeshaunted - ldrender
+// source/ldrender/image.cc
+// contains Image definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "image.hh"
+
+#include <algorithm>
+#include <limits>
+
+#include "profiler.hh"
+
+namespace ldrender {
+
+bool BMPWriter::open(const std::string& file_name, int width, int height, int bits_per_pixel) {
+    if (bits_per_pixel != 24 && bits_per_pixel != 32) {
+        return false;
+    }
+
+    this->file = std::ofstream(file_name, std::ios::binary);
+    if (!this->file) return false;
+
+    this->width = width;
+    this->bytes_per_pixel = bits_per_pixel / 8;
+    int row_padding = (4 - (width * this->bytes_per_pixel) % 4) % 4;
+    this->row_buffer.assign(width * this->bytes_per_pixel + row_padding, 0);
+
+    uint64_t total_size = 54 + static_cast<uint64_t>(this->row_buffer.size()) * height;
+    if (total_size > std::numeric_limits<uint32_t>::max()) {
+        return false; // too large for the 32-bit size fields
+    }
+
+    uint32_t raw_bitmap_size = total_size - 54;
+    uint32_t file_size = total_size;
+    uint32_t reserved = 0;
+    uint32_t pixel_data_offset = 54;
+    uint32_t dib_header_size = 40;
+    int32_t bitmap_width = width;
+    int32_t bitmap_height = height;
+    uint16_t planes = 1;
+    uint16_t bits = bits_per_pixel;
+    uint32_t compression = 0;
+    int32_t h_res = 2835;
+    int32_t v_res = 2835;
+    uint32_t num_colors = 0;
+    uint32_t important_colors = 0;
+
+    this->file.put('B').put('M');
+    this->file.write((char*)&file_size, 4);
+    this->file.write((char*)&reserved, 4);
+    this->file.write((char*)&pixel_data_offset, 4);
+
+    this->file.write((char*)&dib_header_size, 4);
+    this->file.write((char*)&bitmap_width, 4);
+    this->file.write((char*)&bitmap_height, 4);
+    this->file.write((char*)&planes, 2);
+    this->file.write((char*)&bits, 2);
+    this->file.write((char*)&compression, 4);
+    this->file.write((char*)&raw_bitmap_size, 4);
+    this->file.write((char*)&h_res, 4);
+    this->file.write((char*)&v_res, 4);
+    this->file.write((char*)&num_colors, 4);
+    this->file.write((char*)&important_colors, 4);
+
+    return this->file.good();
+}
+
+bool BMPWriter::writeRow(const uint32_t* row) {
+    for (int x = 0; x < this->width; x++) {
+        uint32_t pixel = row[x];
+        char* out = &this->row_buffer[x * this->bytes_per_pixel];
+        out[0] = pixel & 0xFF; // b
+        out[1] = (pixel >> 8) & 0xFF; // g
+        out[2] = (pixel >> 16) & 0xFF; // r
+        if (this->bytes_per_pixel == 4) {
+            out[3] = (pixel >> 24) & 0xFF;
+        }
+    }
+    this->file.write(this->row_buffer.data(), this->row_buffer.size());
+
+    return this->file.good();
+}
+
+bool BMPWriter::close() {
+    this->file.close();
+
+    return !this->file.fail();
+}
+
+bool BMPWriter::writeImage(const std::string& file_name, int width, int height, const uint32_t* pixels, int bits_per_pixel) {
+    ProfileScope scope("save_bmp");
+
+    BMPWriter writer;
+    if (!writer.open(file_name, width, height, bits_per_pixel)) {
+        return false;
+    }
+
+    for (int y = height - 1; y >= 0; y--) {
+        if (!writer.writeRow(&pixels[static_cast<size_t>(y) * width])) {
+            return false;
+        }
+    }
+
+    return writer.close();
+}
+
+Image::Image(int width, int height, uint32_t clear_value, int origin_y) : width(width), height(height), origin_y(origin_y), depth_buffer(width * height, std::numeric_limits<float>::lowest()), owned_pixels(width * height, clear_value), pixels(owned_pixels.data()), count_pixels(Profiler::isEnabled()) {}
+
+Image::Image(uint32_t* pixels, int width, int height, uint32_t clear_value) : width(width), height(height), origin_y(0), depth_buffer(width * height, std::numeric_limits<float>::lowest()), pixels(pixels), count_pixels(Profiler::isEnabled()) {
+    std::fill(this->pixels, this->pixels + static_cast<size_t>(width) * height, clear_value);
+}
+
+int Image::getWidth() {
+    return this->width;
+}
+
+int Image::getHeight() {
+    return this->height;
+}
+
+int Image::getOriginY() {
+    return this->origin_y;
+}
+
+uint32_t* Image::getPixels() {
+    return this->pixels;
+}
+
+void Image::clear(uint32_t clear_value, int origin_y) {
+    this->origin_y = origin_y;
+    this->count_pixels = Profiler::isEnabled();
+    std::fill(this->depth_buffer.begin(), this->depth_buffer.end(), std::numeric_limits<float>::lowest());
+    std::fill(this->pixels, this->pixels + this->depth_buffer.size(), clear_value);
+}
+
+void Image::setPixel(int x, int y, float z, uint32_t value) {
+    y -= this->origin_y;
+    if (x >= 0 && x < this->width && y >= 0 && y < this->height) {
+        size_t index = y * this->width + x;
+        if (this->count_pixels) {
+            ++this->pixels_tested;
+            if (z > this->depth_buffer[index]) {
+                ++this->pixels_written;
+                if (this->depth_buffer[index] != std::numeric_limits<float>::lowest()) {
+                    ++this->pixels_overwritten;
+                }
+            }
+        }
+        if (z > this->depth_buffer[index]) {
+            this->pixels[index] = value;
+            this->depth_buffer[index] = z;
+        }
+    }
+}
+
+void Image::flushProfileCounters() {
+    Profiler::addCounter(ProfileCounter::PIXELS_TESTED, this->pixels_tested);
+    Profiler::addCounter(ProfileCounter::PIXELS_WRITTEN, this->pixels_written);
+    Profiler::addCounter(ProfileCounter::PIXELS_OVERWRITTEN, this->pixels_overwritten);
+    this->pixels_tested = 0;
+    this->pixels_written = 0;
+    this->pixels_overwritten = 0;
+    this->count_pixels = Profiler::isEnabled();
+}
+
+bool Image::saveBMP(const std::string& file_name, int bits_per_pixel) {
+    return BMPWriter::writeImage(file_name, this->width, this->height, this->pixels, bits_per_pixel);
+}
+
+} // namespace ldrender
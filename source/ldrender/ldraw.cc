@@ -18,8 +18,12 @@
 #include <iostream> // GET RID OF THIS
 #include <fstream>
 #include <sstream>
+#include <thread>
 
+#include "archive.hh"
+#include "file_reader.hh"
 #include "ldraw.hh"
+#include "profiler.hh"
 #include "utilities.hh"
 
 namespace ldrender {
@@ -88,30 +92,459 @@ Vector3 TransformMatrix::operator*(Vector3& other) {
 
 LDraw::LDraw(std::string library_path) {
     this->is_root_model = true;
-    LDraw::library_path = library_path;
-
-    this->loadLDConfig();
+    this->has_library = LDraw::loadLibrary(library_path);
+    if (this->has_library) {
+        LDraw::root_models.insert(this);
+    }
 }
 
 LDraw::~LDraw() {
-    if (this->is_root_model) {
-        for (auto& model : LDraw::loaded_models) {
-            delete model.second;
+    if (!this->is_root_model || !this->has_library) {
+        return; // submodels are freed by their root, a root without a library never registered anything
+    }
+    LDraw::releaseLibrary();
+    LDraw::root_models.erase(this);
+
+    auto collectReachable = [this](std::vector<LDraw*> pending_models, std::unordered_set<LDraw*>& reached_models) {
+        while (!pending_models.empty()) {
+            LDraw* model = pending_models.back();
+            pending_models.pop_back();
+            if (model == this || !reached_models.insert(model).second) {
+                continue;
+            }
+
+            for (LDrawSubFile& subfile : model->subfiles) {
+                pending_models.push_back(subfile.model);
+            }
+        }
+    };
+
+    // whatever another live root uses stays, no matter which root created it
+    std::unordered_set<LDraw*> kept_models;
+    collectReachable(std::vector<LDraw*>(LDraw::root_models.begin(), LDraw::root_models.end()), kept_models);
+
+    // library parts stay cached along with everything they reference
+    std::vector<LDraw*> library_parts;
+    for (auto& model : LDraw::loaded_models) {
+        if (model.second->is_library_part) {
+            library_parts.push_back(model.second);
+        }
+    }
+    std::unordered_set<LDraw*> library_models;
+    collectReachable(library_parts, library_models);
+
+    bool library_shadowed = false;
+    for (LDraw* model : library_models) {
+        if (!model->is_library_part && !model->source_path.empty() && !kept_models.contains(model)) {
+            library_shadowed = true; // a part now includes a model file no other root uses, so none of them can be reused
+            break;
         }
     }
+    if (!library_shadowed) {
+        kept_models.insert(library_models.begin(), library_models.end());
+    }
+
+    // free what this root created, plus parts and orphaned models that nothing uses anymore
+    std::unordered_set<LDraw*> freed_models;
+    for (auto& model : LDraw::loaded_models) {
+        LDraw* loaded_model = model.second;
+        if (loaded_model->is_root_model || kept_models.contains(loaded_model)) {
+            if (loaded_model->owner == this) {
+                loaded_model->owner = nullptr;
+            }
+            continue;
+        }
+        if (loaded_model->owner == this || loaded_model->owner == nullptr || loaded_model->is_library_part) {
+            freed_models.insert(loaded_model);
+        }
+    }
+
+    for (auto model = LDraw::file_models.begin(); model != LDraw::file_models.end();) {
+        if (model->second != this && !freed_models.contains(model->second)) {
+            ++model;
+            continue;
+        }
+        LDraw::file_times.erase(model->first);
+        model = LDraw::file_models.erase(model);
+    }
+
+    for (auto model = LDraw::loaded_models.begin(); model != LDraw::loaded_models.end();) {
+        if (model->second != this && !freed_models.contains(model->second)) {
+            ++model;
+            continue;
+        }
+        model = LDraw::loaded_models.erase(model);
+    }
+
+    for (LDraw* model : freed_models) {
+        delete model;
+    }
 }
 
 bool LDraw::wasLoaded() {
     return this->was_loaded;
 }
 
+bool LDraw::wasFound() {
+    return this->has_library && (!this->from_file || !this->source_path.empty());
+}
+
 void LDraw::loadFromData(std::string model_data) {
+    if (!this->has_library) {
+        return;
+    }
+
+    this->was_loaded = true;
+
+    this->loadSections(model_data, false);
+}
+
+void LDraw::loadFromFile(std::string file_path) {  
+    ProfileScope scope(this->is_root_model ? "load_model" : "load_file");
+
+    if (!this->has_library) {
+        return; // another library is still in use
+    }
+
     this->was_loaded = true;
+    this->from_file = true;
+
+    if (this->is_root_model) {
+        this->name = Utilities::toLowercaseString(file_path);
+        LDraw::loaded_models.insert({this->name, this});
+    }
+
+    std::string model_data;
+    if (LDraw::readModelFile(file_path, model_data, this->source_path)) {
+        LDraw::file_models[this->source_path] = this;
+        this->is_library_part = !this->is_root_model && this->source_path != file_path;
+    } else if (LDraw::readArchiveModel(file_path, model_data, this->source_path)) {
+        this->is_library_part = !this->is_root_model;
+    } else {
+        return; // unable to find file, TODO: do something here?
+    }
+
+    this->loadSections(model_data, false);
+
+    if (this->is_root_model) {
+        this->loadPendingModels();
+    }
+}
+
+void LDraw::setLoaderType(LoaderType loader_type) {
+    LDraw::loader_type = loader_type;
+}
+
+bool LDraw::loadLibrary(const std::string& library_path) {
+    if (!LDraw::library_loaded || LDraw::library_path != library_path) {
+        if (LDraw::library_users > 0) {
+            return false; // live models still point at the current colors and parts
+        }
+
+        LDraw::unloadLibrary();
+        LDraw::library_path = library_path;
+
+        if (std::filesystem::is_regular_file(library_path)) {
+            LDraw::library_archive = new Archive();
+            if (!LDraw::library_archive->open(library_path)) {
+                delete LDraw::library_archive;
+                LDraw::library_archive = nullptr;
+                return false; // not a ZIP this can read, so there is no library to fall back to
+            }
+        }
+
+        LDraw::loadLDConfig();
+        LDraw::library_loaded = true;
+    }
+    ++LDraw::library_users;
+
+    return true;
+}
+
+void LDraw::releaseLibrary() {
+    if (LDraw::library_users > 0) {
+        --LDraw::library_users;
+    }
+}
+
+bool LDraw::unloadLibrary() {
+    if (LDraw::library_users > 0) {
+        return false;
+    }
+
+    for (auto& model : LDraw::loaded_models) {
+        if (!model.second->is_root_model) {
+            delete model.second;
+        }
+    }
+    LDraw::loaded_models.clear();
+    LDraw::file_models.clear();
+    LDraw::file_times.clear();
 
-    std::stringstream model_data_stream;
-    model_data_stream << model_data;
+    for (auto& color : LDraw::color_map) {
+        delete color.second;
+    }
+    LDraw::color_map.clear();
+
+    delete LDraw::library_archive;
+    LDraw::library_archive = nullptr;
+    LDraw::library_loaded = false;
+
+    return true;
+}
+
+size_t LDraw::getLoadedFileCount() {
+    return LDraw::file_models.size();
+}
+
+bool LDraw::reload() {
+    ProfileScope scope("reload");
+
+    std::unordered_set<LDraw*> changed_models;
+
+    std::vector<std::pair<std::string, LDraw*>> files(LDraw::file_models.begin(), LDraw::file_models.end());
+    for (auto& [path, model] : files) {
+        std::error_code error;
+        std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+        if (error || write_time == LDraw::file_times[path]) {
+            continue;
+        }
+
+        std::string model_data;
+        std::string resolved_path;
+        if (LDraw::readModelFile(path, model_data, resolved_path)) {
+            for (LDraw* changed_model : model->loadSections(model_data, true)) {
+                changed_models.insert(changed_model);
+            }
+        }
+    }
+
+    // files that could not be found before may exist by now
+    std::vector<std::pair<std::string, LDraw*>> models(LDraw::loaded_models.begin(), LDraw::loaded_models.end());
+    for (auto& [name, model] : models) {
+        if (model->from_file && model->source_path.empty()) {
+            std::string model_data;
+            bool found = false;
+            if (LDraw::readModelFile(name, model_data, model->source_path)) {
+                LDraw::file_models[model->source_path] = model;
+                model->is_library_part = !model->is_root_model && model->source_path != name;
+                found = true;
+            } else {
+                found = LDraw::readArchiveModel(name, model_data, model->source_path);
+                model->is_library_part = found && !model->is_root_model;
+            }
+
+            if (found) {
+                for (LDraw* changed_model : model->loadSections(model_data, true)) {
+                    changed_models.insert(changed_model);
+                }
+            }
+        }
+    }
+
+    if (changed_models.empty()) {
+        return false;
+    }
+
+    this->loadPendingModels();
+
+    // only flattened geometry that includes a changed model has to be rebuilt
+    std::unordered_map<LDraw*, std::vector<LDraw*>> parents;
+    for (auto& model : LDraw::loaded_models) {
+        for (LDrawSubFile& subfile : model.second->subfiles) {
+            parents[subfile.model].push_back(model.second);
+        }
+    }
+    for (LDrawSubFile& subfile : this->subfiles) {
+        parents[subfile.model].push_back(this);
+    }
+
+    std::unordered_set<LDraw*> invalidated_models;
+    std::vector<LDraw*> pending_models(changed_models.begin(), changed_models.end());
+    while (!pending_models.empty()) {
+        LDraw* model = pending_models.back();
+        pending_models.pop_back();
+        if (!invalidated_models.insert(model).second) {
+            continue;
+        }
+
+        model->invalidateBuild();
+        for (LDraw* parent : parents[model]) {
+            pending_models.push_back(parent);
+        }
+    }
+
+    return true;
+}
+
+std::vector<LDrawLine> LDraw::buildLines() {
+    ProfileScope scope("build_lines");
+
+    return this->getBuiltLines();
+}
+
+std::vector<LDrawTri> LDraw::buildTris() {
+    ProfileScope scope("build_tris");
+
+    return this->getBuiltTris();
+}
+
+std::vector<LDrawQuad> LDraw::buildQuads() {
+    ProfileScope scope("build_quads");
+
+    return this->getBuiltQuads();
+}
+
+LDrawSourceTable LDraw::buildSourceTable() {
+    ProfileScope scope("build_sources");
+
+    LDrawSourceTable table;
+    std::unordered_map<LDraw*, uint32_t> name_indices;
+    for (int line_type = 2; line_type <= 4; ++line_type) {
+        std::unordered_map<LDraw*, uint32_t> instance_counts;
+        this->appendSources(line_type, table, name_indices, instance_counts);
+    }
+
+    return table;
+}
+
+std::string LDraw::library_path;
+
+bool LDraw::library_loaded = false;
+
+size_t LDraw::library_users = 0;
+
+LoaderType LDraw::loader_type = LoaderType::IO_URING;
+
+Archive* LDraw::library_archive = nullptr;
+
+std::mutex LDraw::models_mutex;
+
+std::unordered_map<std::string, LDraw*> LDraw::loaded_models;
+
+std::unordered_set<LDraw*> LDraw::root_models;
+
+std::unordered_map<int, LDrawColor*> LDraw::color_map;
+
+std::unordered_map<std::string, LDraw*> LDraw::file_models;
+
+std::unordered_map<std::string, std::filesystem::file_time_type> LDraw::file_times;
+
+LDraw::LDraw() {
+
+}
+
+void LDraw::loadLDConfig() {
+    ProfileScope scope("ldconfig");
+
+    std::stringstream config_data;
+    std::string archive_config_data;
+    if (LDraw::library_archive && LDraw::library_archive->read("LDConfig.ldr", archive_config_data)) {
+        config_data << archive_config_data;
+    } else {
+        std::ifstream config_file(LDraw::library_path + "/LDConfig.ldr");
+        config_data << config_file.rdbuf();
+        config_file.close();
+    }
+
+    std::string config_line;
+    while (std::getline(config_data, config_line)) {
+        std::vector<std::string> tokens = Utilities::splitStringByWhitespace(config_line);
+
+        if (tokens.size() > 3) {
+            if (tokens[0][0] == '0' && tokens[1] == "!COLOUR") {
+                LDrawColor* new_color = new LDrawColor();
+                new_color->name = tokens[2];
+                int code = 0;
+
+                for (size_t i = 3; i < tokens.size(); ++i) {
+                    if (!(i + 1 < tokens.size())) {
+                        break;
+                    }
+                    if (tokens[i] == "CODE") {
+                        code = std::stoi(tokens[i + 1]);
+                    }
+                    if (tokens[i] == "VALUE") {
+                        new_color->main = std::stoul(tokens[i + 1].substr(1), nullptr, 16);
+                    }
+                    if (tokens[i] == "EDGE") {
+                        new_color->edge = std::stoul(tokens[i + 1].substr(1), nullptr, 16);
+                    }
+                }
+
+                LDraw::color_map.insert({code, new_color});
+            }
+        }
+    }
+}
+
+std::vector<LDraw*> LDraw::loadSections(const std::string& model_data, bool skip_unchanged, std::unordered_set<LDraw*>* claimed_models) {
+    ProfileScope scope("parse");
+
+    std::vector<std::pair<std::string, std::string>> sections = LDraw::splitSections(model_data);
+
+    // claim every section up front so the pipelined loader never goes looking for them on disk
+    LDraw* owner = this->is_root_model ? this : this->owner;
+    std::vector<LDraw*> section_models;
+    for (size_t i = 0; i < sections.size(); ++i) {
+        LDraw* model = i == 0 ? this : LDraw::getOrCreateModel(sections[i].first, owner, true);
+        if (i != 0 && claimed_models) {
+            // the pipelined loader parses every model once, whether its file or a section gets to it first
+            std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+            if (!claimed_models->insert(model).second) {
+                model = nullptr;
+            }
+        }
+        section_models.push_back(model);
+    }
+
+    // a section shadowing a part cached by an earlier root model makes every flattened model that includes it stale
+    bool shadows_library = false;
+    for (size_t i = 1; i < section_models.size() && !this->is_library_part; ++i) {
+        if (section_models[i] && section_models[i]->is_library_part) {
+            section_models[i]->is_library_part = false;
+            section_models[i]->owner = owner;
+            shadows_library = true;
+        }
+    }
+    if (shadows_library) {
+        std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+        for (auto& model : LDraw::loaded_models) {
+            model.second->invalidateBuild();
+        }
+    }
+
+    std::vector<LDraw*> parsed_models;
+    for (size_t i = 0; i < sections.size(); ++i) {
+        LDraw* model = section_models[i];
+        if (!model) {
+            continue;
+        }
+        size_t content_hash = std::hash<std::string>{}(sections[i].second);
+        if (skip_unchanged && model->content_hash == content_hash) {
+            continue; // section is unchanged, keep what was parsed before
+        }
+
+        model->content_hash = content_hash;
+        if (i != 0) {
+            model->source_path = this->source_path;
+            model->is_library_part = this->is_library_part;
+        }
+        model->clearGeometry();
+        model->parseSection(sections[i].second);
+
+        parsed_models.push_back(model);
+    }
+
+    return parsed_models;
+}
+
+void LDraw::parseSection(const std::string& section_data) {
+    std::stringstream model_data_stream(section_data);
     std::string line_data;
+    uint64_t line_count = 0;
     while (std::getline(model_data_stream, line_data)) {
+        ++line_count;
         line_data = Utilities::trimString(line_data);
         if (line_data.empty()) {
             continue;
@@ -119,30 +552,7 @@ void LDraw::loadFromData(std::string model_data) {
         char line_type = line_data.at(0);
         std::vector<std::string> tokens = Utilities::splitStringByWhitespace(line_data);
 
-        bool file_directive = false;
         switch (line_type) {
-            case '0': {
-                if (tokens.size() > 2) {
-                    if (tokens[1] == "FILE") {
-                        if (this->is_root_model && this->subfiles.empty() && this->lines.empty() && this->tris.empty() && this->quads.empty() && this->optlines.empty()) {
-                            break; // FILE directive for main model, ignore
-                        }
-                        std::string file_name = Utilities::toLowercaseString(Utilities::trimString(line_data.substr(line_data.find("FILE") + 4)));
-                        LDraw* file = nullptr;
-                        if (!LDraw::loaded_models.contains(file_name)) {
-                            file = new LDraw();
-                            LDraw::loaded_models.insert({file_name, file});
-                        } else {
-                            file = LDraw::loaded_models.at(file_name);
-                        }
-                        std::stringstream temp_stream;
-                        temp_stream << model_data_stream.rdbuf();
-                        file->loadFromData(temp_stream.str());
-                        file_directive = true;
-                    }
-                }
-                break;
-            }    
             case '1': {
                 if (tokens.size() > 14) {
                     LDrawColor* color = nullptr;
@@ -151,13 +561,7 @@ void LDraw::loadFromData(std::string model_data) {
                         color = LDraw::color_map.at(color_code);
                     }
                     std::string subfile_name = Utilities::toLowercaseString(Utilities::trimString(Utilities::splitStringByWhitespace(line_data, 15).back()));
-                    LDraw* subfile_model = nullptr;
-                    if (LDraw::loaded_models.contains(subfile_name)) {
-                        subfile_model = LDraw::loaded_models.at(subfile_name);
-                    } else {
-                        subfile_model = new LDraw();
-                        LDraw::loaded_models.insert({subfile_name, subfile_model});
-                    }
+                    LDraw* subfile_model = LDraw::getOrCreateModel(subfile_name, this->is_root_model ? this : this->owner);
                     LDrawSubFile subfile(
                         color, // color
                         TransformMatrix(
@@ -270,100 +674,179 @@ void LDraw::loadFromData(std::string model_data) {
             default:
                 break;
         }
-
-        if (file_directive) {
-            return;
-        }
     }
+
+    Profiler::addCounter(ProfileCounter::LINES_PARSED, line_count);
+    Profiler::addCounter(ProfileCounter::SUBFILE_PRIMITIVES, this->subfiles.size());
+    Profiler::addCounter(ProfileCounter::LINE_PRIMITIVES, this->lines.size());
+    Profiler::addCounter(ProfileCounter::TRI_PRIMITIVES, this->tris.size());
+    Profiler::addCounter(ProfileCounter::QUAD_PRIMITIVES, this->quads.size());
 }
 
-void LDraw::loadFromFile(std::string file_path) {  
-    this->was_loaded = true;
+void LDraw::clearGeometry() {
+    this->subfiles.clear();
+    this->lines.clear();
+    this->tris.clear();
+    this->quads.clear();
+    this->optlines.clear();
+}
 
-    if (this->is_root_model) {
-        LDraw::loaded_models.insert({Utilities::toLowercaseString(file_path), this});
-    }
+void LDraw::invalidateBuild() {
+    this->lines_built = false;
+    this->tris_built = false;
+    this->quads_built = false;
+    this->built_lines.clear();
+    this->built_tris.clear();
+    this->built_quads.clear();
+}
 
-    std::ifstream file(file_path);
-    if (!file.good()) {
-        file = std::ifstream(LDraw::library_path + "/parts/" + file_path);
-    }
-    if (!file.good()) {
-        file = std::ifstream(LDraw::library_path + "/p/" + file_path);
+void LDraw::loadPendingModels() {
+    ProfileScope scope("load_pending");
+
+    if (LDraw::loader_type == LoaderType::SERIAL) {
+        // loading a model can discover new ones, so collect first instead of loading while iterating the map
+        std::vector<std::pair<std::string, LDraw*>> pending_models;
+        do {
+            pending_models.clear();
+            for (auto& model : LDraw::loaded_models) {
+                if (!model.second->wasLoaded()) {
+                    pending_models.push_back(model);
+                }
+            }
+
+            for (auto& model : pending_models) {
+                model.second->loadFromFile(model.first);
+            }
+        } while (!pending_models.empty());
+
+        return;
     }
-    if (!file.good()) {
-        return; // unable to find file, TODO: do something here?
+
+    // the reader fetches files in the background while parser threads consume them and queue up the subfiles they discover
+    FileReader reader(LDraw::loader_type == LoaderType::IO_URING, 16);
+    std::unordered_set<LDraw*> claimed_models; // guarded by models_mutex, models a parser thread has taken
+
+    for (auto& model : LDraw::loaded_models) {
+        if (!model.second->was_loaded) {
+            model.second->was_loaded = true;
+            reader.submit(reinterpret_cast<size_t>(model.second), LDraw::getCandidatePaths(model.first));
+        }
     }
 
-    std::stringstream model_data;
-    
-    model_data << file.rdbuf();
-    file.close();
+    auto parse_files = [&reader, &claimed_models]() {
+        FileReadResult result;
+        while (reader.next(result)) {
+            LDraw* model = reinterpret_cast<LDraw*>(result.tag);
 
-    this->loadFromData(model_data.str());
+            // another file may have claimed this name as one of its sections while it was being read
+            bool claimed = false;
+            {
+                std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+                claimed = claimed_models.insert(model).second;
+            }
+            if (!claimed) {
+                reader.release();
+                continue;
+            }
 
-    for (auto& model : LDraw::loaded_models) {
-        if (!model.second->wasLoaded()) {
-            model.second->loadFromFile(model.first);
+            model->from_file = true;
+
+            // archive entries are decompressed right here, so they inflate in parallel across the parser threads
+            bool found = result.found;
+            if (found) {
+                std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+                model->source_path = result.path;
+                model->is_library_part = result.path != model->name;
+                LDraw::file_models[result.path] = model;
+                LDraw::file_times[result.path] = result.write_time;
+            } else {
+                found = LDraw::readArchiveModel(model->name, result.data, model->source_path);
+                model->is_library_part = found;
+            }
+
+            if (found) {
+                std::vector<LDraw*> parsed_models = model->loadSections(result.data, false, &claimed_models);
+
+                // submit before releasing this file, otherwise the reader could look drained while work is still coming
+                std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+                for (LDraw* parsed_model : parsed_models) {
+                    for (LDrawSubFile& subfile : parsed_model->subfiles) {
+                        if (!subfile.model->was_loaded) {
+                            subfile.model->was_loaded = true;
+                            reader.submit(reinterpret_cast<size_t>(subfile.model), LDraw::getCandidatePaths(subfile.model->name));
+                        }
+                    }
+                }
+            }
+
+            reader.release();
         }
+    };
+
+    std::vector<std::thread> parser_threads;
+    for (unsigned int i = 1; i < std::thread::hardware_concurrency(); ++i) {
+        parser_threads.emplace_back(parse_files);
+    }
+    parse_files();
+    for (std::thread& thread : parser_threads) {
+        thread.join();
     }
 }
 
-std::vector<LDrawLine> LDraw::buildLines() {
-    std::vector<LDrawLine> output_lines;
-    for (LDrawLine line : this->lines) {
-        output_lines.push_back(line);
+const std::vector<LDrawLine>& LDraw::getBuiltLines() {
+    if (this->lines_built) {
+        return this->built_lines;
     }
 
-    for (LDrawSubFile subfile : subfiles) {
-        std::vector<LDrawLine> subfile_lines = subfile.model->buildLines();
-        for (LDrawLine subfile_line : subfile_lines) {
-            if (subfile_line.color->name == "Edge_Colour") { // IN THEORY someone could use Main_Colour here but fuck that
+    this->built_lines = this->lines;
+    for (LDrawSubFile& subfile : this->subfiles) {
+        for (LDrawLine subfile_line : subfile.model->getBuiltLines()) {
+            if (subfile_line.color && subfile_line.color->name == "Edge_Colour") { // IN THEORY someone could use Main_Colour here but fuck that
                 subfile_line.color = subfile.color;
             }
             subfile_line.position1 = subfile.transform * subfile_line.position1;
             subfile_line.position2 = subfile.transform * subfile_line.position2;
 
-            output_lines.push_back(subfile_line);
+            this->built_lines.push_back(subfile_line);
         }
     }
+    this->lines_built = true;
 
-    return output_lines;
+    return this->built_lines;
 }
 
-std::vector<LDrawTri> LDraw::buildTris() {
-    std::vector<LDrawTri> output_tris;
-    for (LDrawTri tri : this->tris) {
-        output_tris.push_back(tri);
+const std::vector<LDrawTri>& LDraw::getBuiltTris() {
+    if (this->tris_built) {
+        return this->built_tris;
     }
 
-    for (LDrawSubFile subfile : subfiles) {
-        std::vector<LDrawTri> subfile_tris = subfile.model->buildTris();
-        for (LDrawTri subfile_tri : subfile_tris) {
-            if (subfile_tri.color->name == "Main_Colour") { // TODO: do edge colors
+    this->built_tris = this->tris;
+    for (LDrawSubFile& subfile : this->subfiles) {
+        for (LDrawTri subfile_tri : subfile.model->getBuiltTris()) {
+            if (subfile_tri.color && subfile_tri.color->name == "Main_Colour") { // TODO: do edge colors
                 subfile_tri.color = subfile.color;
             }
             subfile_tri.position1 = subfile.transform * subfile_tri.position1;
             subfile_tri.position2 = subfile.transform * subfile_tri.position2;
             subfile_tri.position3 = subfile.transform * subfile_tri.position3;
 
-            output_tris.push_back(subfile_tri);
+            this->built_tris.push_back(subfile_tri);
         }
     }
+    this->tris_built = true;
 
-    return output_tris;
+    return this->built_tris;
 }
 
-std::vector<LDrawQuad> LDraw::buildQuads() {
-    std::vector<LDrawQuad> output_quads;
-    for (LDrawQuad quad : this->quads) {
-        output_quads.push_back(quad);
+const std::vector<LDrawQuad>& LDraw::getBuiltQuads() {
+    if (this->quads_built) {
+        return this->built_quads;
     }
 
-    for (LDrawSubFile subfile : subfiles) {
-        std::vector<LDrawQuad> subfile_quads = subfile.model->buildQuads();
-        for (LDrawQuad subfile_quad : subfile_quads) {
-            if (subfile_quad.color->name == "Main_Colour") { // TODO: do edge colors
+    this->built_quads = this->quads;
+    for (LDrawSubFile& subfile : this->subfiles) {
+        for (LDrawQuad subfile_quad : subfile.model->getBuiltQuads()) {
+            if (subfile_quad.color && subfile_quad.color->name == "Main_Colour") { // TODO: do edge colors
                 subfile_quad.color = subfile.color;
             }
             subfile_quad.position1 = subfile.transform * subfile_quad.position1;
@@ -371,59 +854,158 @@ std::vector<LDrawQuad> LDraw::buildQuads() {
             subfile_quad.position3 = subfile.transform * subfile_quad.position3;
             subfile_quad.position4 = subfile.transform * subfile_quad.position4;
 
-            output_quads.push_back(subfile_quad);
+            this->built_quads.push_back(subfile_quad);
         }
     }
+    this->quads_built = true;
 
-    return output_quads;
+    return this->built_quads;
 }
 
-std::string LDraw::library_path;
+size_t LDraw::getBuiltCount(int line_type) {
+    switch (line_type) {
+        case 2:
+            return this->getBuiltLines().size();
+        case 3:
+            return this->getBuiltTris().size();
+        case 4:
+            return this->getBuiltQuads().size();
+        default:
+            return 0;
+    }
+}
 
-std::unordered_map<std::string, LDraw*> LDraw::loaded_models;
+void LDraw::appendSources(int line_type, LDrawSourceTable& table, std::unordered_map<LDraw*, uint32_t>& name_indices, std::unordered_map<LDraw*, uint32_t>& instance_counts) {
+    auto getNameIndex = [&table, &name_indices](LDraw* model) {
+        auto [name_index, inserted] = name_indices.insert({model, static_cast<uint32_t>(table.names.size())});
+        if (inserted) {
+            table.names.push_back(model->name);
+        }
+        return name_index->second;
+    };
+
+    // same order as getBuilt*, the model's own primitives first, then every subfile in turn
+    uint32_t instance = instance_counts[this]++;
+    size_t own_count = line_type == 2 ? this->lines.size() : line_type == 3 ? this->tris.size() : this->quads.size();
+    LDrawPrimitiveSource own_source = {getNameIndex(this), instance, LDrawPrimitiveSource::NONE, LDrawPrimitiveSource::NONE};
+    table.primitives.insert(table.primitives.end(), own_count, own_source);
+
+    for (size_t i = 0; i < this->subfiles.size(); ++i) {
+        LDraw* model = this->subfiles[i].model;
+        if (!model->is_library_part) {
+            model->appendSources(line_type, table, name_indices, instance_counts);
+            continue;
+        }
 
-std::unordered_map<int, LDrawColor*> LDraw::color_map;
+        LDrawPrimitiveSource part_source = {getNameIndex(this), instance, getNameIndex(model), static_cast<uint32_t>(i)};
+        table.primitives.insert(table.primitives.end(), model->getBuiltCount(line_type), part_source);
+    }
+}
 
-LDraw::LDraw() {
+LDraw* LDraw::getOrCreateModel(const std::string& name, LDraw* owner, bool mark_loaded) {
+    std::lock_guard<std::mutex> lock(LDraw::models_mutex);
+
+    LDraw* model = nullptr;
+    auto existing_model = LDraw::loaded_models.find(name);
+    if (existing_model != LDraw::loaded_models.end()) {
+        model = existing_model->second;
+    } else {
+        model = new LDraw();
+        model->name = name;
+        model->owner = owner;
+        LDraw::loaded_models.insert({name, model});
+    }
+
+    if (mark_loaded) {
+        model->was_loaded = true;
+    }
 
+    return model;
 }
 
-void LDraw::loadLDConfig() {
-    std::ifstream config_file(LDraw::library_path + "/LDConfig.ldr");
-    std::stringstream config_data;
-    
-    config_data << config_file.rdbuf();
-    config_file.close();
+std::vector<std::string> LDraw::getCandidatePaths(const std::string& file_name) {
+    if (LDraw::library_archive) {
+        return {file_name}; // the library itself is looked up in the archive afterwards
+    }
 
-    std::string config_line;
-    while (std::getline(config_data, config_line)) {
-        std::vector<std::string> tokens = Utilities::splitStringByWhitespace(config_line);
+    return {
+        file_name,
+        LDraw::library_path + "/parts/" + file_name,
+        LDraw::library_path + "/p/" + file_name
+    };
+}
 
-        if (tokens.size() > 3) {
-            if (tokens[0][0] == '0' && tokens[1] == "!COLOUR") {
-                LDrawColor* new_color = new LDrawColor();
-                new_color->name = tokens[2];
-                int code = 0;
+bool LDraw::readModelFile(const std::string& file_name, std::string& data, std::string& resolved_path) {
+    ProfileScope scope("read_file");
 
-                for (size_t i = 3; i < tokens.size(); ++i) {
-                    if (!(i + 1 < tokens.size())) {
-                        break;
-                    }
-                    if (tokens[i] == "CODE") {
-                        code = std::stoi(tokens[i + 1]);
-                    }
-                    if (tokens[i] == "VALUE") {
-                        new_color->main = std::stoul(tokens[i + 1].substr(1), nullptr, 16);
-                    }
-                    if (tokens[i] == "EDGE") {
-                        new_color->edge = std::stoul(tokens[i + 1].substr(1), nullptr, 16);
+    for (const std::string& candidate : LDraw::getCandidatePaths(file_name)) {
+        std::ifstream file(candidate);
+        if (!file.good()) {
+            Profiler::addCounter(ProfileCounter::FILES_FAILED, 1);
+            continue;
+        }
+        Profiler::addCounter(ProfileCounter::FILES_OPENED, 1);
+
+        // stat before reading so an edit made during the read is still picked up by reload()
+        std::error_code error;
+        LDraw::file_times[candidate] = std::filesystem::last_write_time(candidate, error);
+
+        std::stringstream model_data;
+        model_data << file.rdbuf();
+        data = model_data.str();
+        resolved_path = candidate;
+        Profiler::addCounter(ProfileCounter::BYTES_READ, data.size());
+
+        return true;
+    }
+
+    return false;
+}
+
+bool LDraw::readArchiveModel(const std::string& file_name, std::string& data, std::string& resolved_path) {
+    if (!LDraw::library_archive) {
+        return false;
+    }
+
+    for (const char* directory : {"parts/", "p/"}) {
+        if (LDraw::library_archive->read(directory + file_name, data)) {
+            resolved_path = LDraw::library_path + "/" + directory + file_name;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<std::pair<std::string, std::string>> LDraw::splitSections(const std::string& model_data) {
+    // the first section belongs to the model itself, every later 0 FILE starts a named submodel
+    std::vector<std::pair<std::string, std::string>> sections(1);
+    bool has_content = false;
+
+    std::stringstream model_data_stream(model_data);
+    std::string line_data;
+    while (std::getline(model_data_stream, line_data)) {
+        std::string trimmed_line = Utilities::trimString(line_data);
+        if (!trimmed_line.empty() && trimmed_line.at(0) == '0') {
+            std::vector<std::string> tokens = Utilities::splitStringByWhitespace(trimmed_line, 3);
+            if (tokens.size() > 2 && tokens[1] == "FILE") {
+                std::string file_name = Utilities::toLowercaseString(Utilities::trimString(trimmed_line.substr(trimmed_line.find("FILE") + 4)));
+                if (!file_name.empty()) {
+                    if (sections.size() > 1 || has_content) {
+                        sections.push_back({file_name, ""});
                     }
+                    continue; // otherwise FILE directive names the model itself, ignore
                 }
-
-                this->color_map.insert({code, new_color});
             }
+        } else if (!trimmed_line.empty() && trimmed_line.at(0) >= '1' && trimmed_line.at(0) <= '5') {
+            has_content = true;
         }
+
+        sections.back().second += line_data;
+        sections.back().second += '\n';
     }
+
+    return sections;
 }
 
 } // namespace ldrender
\ No newline at end of file
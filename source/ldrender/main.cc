@@ -15,190 +15,347 @@
 // See the License for the specific language governing permissionsand
 // limitations under the License.
 
-#include <iostream>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
-#include <algorithm>
-#include <cmath>
 
+#include "engine.hh"
+#include "image.hh"
 #include "ldraw.hh"
+#include "profiler.hh"
+#include "renderer.hh"
+#include "utilities.hh"
 
 using namespace ldrender;
 
-class Image {
-private:
-    int width, height;
-    std::vector<std::vector<float>> zBuffer; // Z-buffer
-    std::vector<uint32_t> pixels;
+struct RenderOptions {
+    bool visibility = false;
+    bool flat_shading = false;
+    bool tiled = false;
+    std::string id_map_path;
+    std::string id_table_path;
+    int width = 1920;
+    int height = 1080;
+    size_t memory_budget = 256;
+};
 
-public:
-    Image(int w, int h) : width(w), height(h), pixels(w * h), zBuffer(w, std::vector<float>(h, std::numeric_limits<float>::lowest())) {}
+struct JobEntry {
+    std::string model_path;
+    std::string output_path;
+    int width;
+    int height;
+};
 
-    void setPixel(int x, int y, float z, uint32_t color) {
-        if (x >= 0 && x < width && y >= 0 && y < height) {
-            if (z > zBuffer[x][y]) {
-                pixels[y * width + x] = color;
-                zBuffer[x][y] = z;
-            }
+static void printUsage() {
+    std::cerr << "usage: ldrender [options]" << std::endl;
+    std::cerr << "  --library <path>   LDraw library directory or ZIP archive such as complete.zip (default ldraw)" << std::endl;
+    std::cerr << "  --model <file>     model to render (default model.ldr)" << std::endl;
+    std::cerr << "  --output <file>    where to save the render (default output.bmp)" << std::endl;
+    std::cerr << "  --jobs <file>      render every '<model> <output> [<width> <height>]' line of file, loading the library once" << std::endl;
+    std::cerr << "  --visibility       rasterize primitive ids and resolve colors in a separate pass" << std::endl;
+    std::cerr << "  --id-map <file>    also save the primitive id map as a 32-bit BMP (implies --visibility)" << std::endl;
+    std::cerr << "  --id-table <file>  save which submodel and part reference every primitive id came from" << std::endl;
+    std::cerr << "  --flat-shading     shade tris and quads by their facing" << std::endl;
+    std::cerr << "  --width <pixels>   output width (default 1920)" << std::endl;
+    std::cerr << "  --height <pixels>  output height (default 1080)" << std::endl;
+    std::cerr << "  --tiled            render in bands of rows and stream them to the output file" << std::endl;
+    std::cerr << "  --memory-budget <MiB>  pixel memory per band in tiled mode (default 256)" << std::endl;
+    std::cerr << "  --watch            re-render whenever the model files change" << std::endl;
+    std::cerr << "  --loader <type>    serial, threads or io_uring (default io_uring, falls back to threads)" << std::endl;
+    std::cerr << "  --profile <file>   write per phase timings and counters as JSON" << std::endl;
+    std::cerr << "  --profile-trace <file>  write a per thread timeline in Chrome trace format" << std::endl;
+}
+
+// blank lines and lines starting with # are skipped, sizes default to the ones given on the command line
+static bool readJobList(const std::string& file_name, const RenderOptions& options, std::vector<JobEntry>& entries) {
+    std::ifstream file(file_name);
+    if (!file) return false;
+
+    std::string line_data;
+    while (std::getline(file, line_data)) {
+        line_data = Utilities::trimString(line_data);
+        if (line_data.empty() || line_data[0] == '#') {
+            continue;
         }
-    }
 
-    bool saveBMP(const std::string &filename) {
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) return false;
-
-        uint32_t fileSize = 54 + 3 * width * height;
-        uint32_t reserved = 0;
-        uint32_t headerSize = 54;
-        uint32_t pixelDataOffset = 54;
-        uint32_t dibHeaderSize = 40;
-        uint16_t planes = 1;
-        uint16_t bitsPerPixel = 24;
-        uint32_t compression = 0;
-        uint32_t rawBitmapSize = 3 * width * height;
-        int32_t hRes = 2835;
-        int32_t vRes = 2835;
-        uint32_t numColors = 0;
-        uint32_t importantColors = 0;
-
-        file.put('B').put('M');
-        file.write((char*)&fileSize, 4);
-        file.write((char*)&reserved, 4);
-        file.write((char*)&pixelDataOffset, 4);
-
-        file.write((char*)&dibHeaderSize, 4);
-        file.write((char*)&width, 4);
-        file.write((char*)&height, 4);
-        file.write((char*)&planes, 2);
-        file.write((char*)&bitsPerPixel, 2);
-        file.write((char*)&compression, 4);
-        file.write((char*)&rawBitmapSize, 4);
-        file.write((char*)&hRes, 4);
-        file.write((char*)&vRes, 4);
-        file.write((char*)&numColors, 4);
-        file.write((char*)&importantColors, 4);
-
-        for (int y = height - 1; y >= 0; y--) {
-            for (int x = 0; x < width; x++) {
-                uint32_t pixel = pixels[y * width + x];
-                uint8_t r = (pixel >> 16) & 0xFF;
-                uint8_t g = (pixel >> 8) & 0xFF;
-                uint8_t b = pixel & 0xFF;
-                file.put(b).put(g).put(r);
+        JobEntry entry = {"", "", options.width, options.height};
+        std::stringstream line_stream(line_data);
+        if (!(line_stream >> entry.model_path >> entry.output_path)) {
+            return false;
+        }
+        if (line_stream >> entry.width) {
+            if (!(line_stream >> entry.height) || entry.width <= 0 || entry.height <= 0) {
+                return false;
             }
         }
 
-        return true;
+        entries.push_back(entry);
     }
-};
 
-void drawLine(Image &img, int x0, int y0, float z0, int x1, int y1, float z1, uint32_t color) {
-    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
-    if (steep) {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-    }
+    return true;
+}
+
+static RenderJob makeJob(const JobEntry& entry, const RenderOptions& options) {
+    RenderJob job;
+    job.model_path = entry.model_path;
+    job.width = entry.width;
+    job.height = entry.height;
+    job.visibility = options.visibility;
+    job.flat_shading = options.flat_shading;
 
-    if (x0 > x1) {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
-        std::swap(z0, z1); // Swap z values accordingly
+    return job;
+}
+
+static bool renderTiled(Engine& engine, const RenderJob& job, const std::string& output_path, const RenderOptions& options) {
+    BMPWriter output;
+    BMPWriter id_output;
+    bool saved = output.open(output_path, job.width, job.height);
+    if (!options.id_map_path.empty() && !id_output.open(options.id_map_path, job.width, job.height, 32)) {
+        std::cerr << "Failed to save id map." << std::endl;
+        return false;
     }
+    saved = saved && engine.renderTiled(job, options.memory_budget * 1024 * 1024, output, options.id_map_path.empty() ? nullptr : &id_output);
+    saved = output.close() && saved;
+    if (!options.id_map_path.empty() && !id_output.close()) {
+        std::cerr << "Failed to save id map." << std::endl;
+    }
+
+    return saved;
+}
 
-    int dx = x1 - x0;
-    int dy = std::abs(y1 - y0);
-    float dz = (z1 - z0) / static_cast<float>(dx);
-    int error = dx / 2;
-    int ystep = (y0 < y1) ? 1 : -1;
-    int y = y0;
-    float z = z0;
+// one tab separated line per run of ids with the same source, the part is - for primitives of the submodel itself
+static bool writeSourceTable(const std::string& file_name, const LDrawSourceTable& table) {
+    std::ofstream file(file_name);
+    if (!file) return false;
 
-    for (int x = x0; x <= x1; x++) {
-        if (steep) {
-            img.setPixel(y, x, z, color);
-        } else {
-            img.setPixel(x, y, z, color);
+    file << "# first_id\tlast_id\tsubmodel\tinstance\tpart\treference\n";
+    for (size_t first = 0; first < table.primitives.size();) {
+        const LDrawPrimitiveSource& source = table.primitives[first];
+        size_t last = first;
+        while (last + 1 < table.primitives.size() && table.primitives[last + 1].submodel == source.submodel && table.primitives[last + 1].instance == source.instance && table.primitives[last + 1].part == source.part && table.primitives[last + 1].reference == source.reference) {
+            ++last;
         }
-        error -= dy;
-        z += dz; // Increment z along the line
-        if (error < 0) {
-            y += ystep;
-            error += dx;
+
+        file << first << '\t' << last << '\t' << table.names[source.submodel] << '\t' << source.instance << '\t';
+        if (source.part == LDrawPrimitiveSource::NONE) {
+            file << "-\t-\n";
+        } else {
+            file << table.names[source.part] << '\t' << source.reference << '\n';
         }
+        first = last + 1;
     }
+
+    return file.good();
 }
 
-void fillTriangle(Image &img, const LDrawTri &tri) {
-    // Find bounding box
-    int minX = std::min({tri.position1.x, tri.position2.x, tri.position3.x});
-    int minY = std::min({tri.position1.y, tri.position2.y, tri.position3.y});
-    int maxX = std::max({tri.position1.x, tri.position2.x, tri.position3.x});
-    int maxY = std::max({tri.position1.y, tri.position2.y, tri.position3.y});
-
-    // Iterate over pixels in the bounding box
-    for (int y = minY; y <= maxY; y++) {
-        for (int x = minX; x <= maxX; x++) {
-            // Barycentric coordinates to determine if point is inside the triangle
-            float alpha = ((tri.position2.y - tri.position3.y) * (x - tri.position3.x) + (tri.position3.x - tri.position2.x) * (y - tri.position3.y)) /
-                          ((tri.position2.y - tri.position3.y) * (tri.position1.x - tri.position3.x) + (tri.position3.x - tri.position2.x) * (tri.position1.y - tri.position3.y));
-            float beta = ((tri.position3.y - tri.position1.y) * (x - tri.position3.x) + (tri.position1.x - tri.position3.x) * (y - tri.position3.y)) /
-                         ((tri.position2.y - tri.position3.y) * (tri.position1.x - tri.position3.x) + (tri.position3.x - tri.position2.x) * (tri.position1.y - tri.position3.y));
-            float gamma = 1.0f - alpha - beta;
-
-            if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-                // Interpolate z value
-                float z = alpha * tri.position1.z + beta * tri.position2.z + gamma * tri.position3.z;
-                img.setPixel(x, y, z, tri.color->main);
+static bool renderModel(Engine& engine, LDraw& model, const std::string& output_path, const RenderOptions& options) {
+    if (!options.id_table_path.empty() && !writeSourceTable(options.id_table_path, model.buildSourceTable())) {
+        std::cerr << "Failed to save id table." << std::endl;
+    }
+
+    RenderJob job = makeJob({"", output_path, options.width, options.height}, options);
+    job.model = &model;
+
+    if (options.tiled) {
+        return renderTiled(engine, job, output_path, options);
+    }
+
+    size_t pixel_count = static_cast<size_t>(job.width) * job.height;
+    std::vector<uint32_t> pixels(pixel_count);
+    std::vector<uint32_t> ids(options.id_map_path.empty() ? 0 : pixel_count);
+    job.ids = ids.empty() ? nullptr : ids.data();
+    job.pixels = pixels.data();
+    if (!engine.render(job)) {
+        return false;
+    }
+
+    if (!ids.empty() && !BMPWriter::writeImage(options.id_map_path, job.width, job.height, ids.data(), 32)) {
+        std::cerr << "Failed to save id map." << std::endl;
+    }
+
+    return BMPWriter::writeImage(output_path, job.width, job.height, pixels.data());
+}
+
+// renders as many jobs at once as there are hardware threads, so only that many images are in memory
+static size_t renderJobList(Engine& engine, const std::vector<JobEntry>& entries, const RenderOptions& options) {
+    size_t saved_count = 0;
+    if (options.tiled) {
+        for (const JobEntry& entry : entries) {
+            if (renderTiled(engine, makeJob(entry, options), entry.output_path, options)) {
+                ++saved_count;
+            } else {
+                std::cerr << "Failed to render " << entry.model_path << "." << std::endl;
             }
         }
+
+        return saved_count;
     }
+
+    size_t batch_size = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t first = 0; first < entries.size(); first += batch_size) {
+        size_t last = std::min(first + batch_size, entries.size());
+        std::vector<RenderJob> jobs;
+        std::vector<std::vector<uint32_t>> buffers;
+        for (size_t i = first; i < last; ++i) {
+            buffers.emplace_back(static_cast<size_t>(entries[i].width) * entries[i].height);
+            jobs.push_back(makeJob(entries[i], options));
+            jobs.back().pixels = buffers.back().data();
+        }
+
+        std::vector<bool> results = engine.renderBatch(jobs);
+        for (size_t i = first; i < last; ++i) {
+            const JobEntry& entry = entries[i];
+            if (results[i - first] && BMPWriter::writeImage(entry.output_path, entry.width, entry.height, buffers[i - first].data())) {
+                ++saved_count;
+            } else {
+                std::cerr << "Failed to render " << entry.model_path << "." << std::endl;
+            }
+        }
+    }
+
+    return saved_count;
 }
 
-void fillQuad(Image &img, const LDrawQuad &quad) {
-    fillTriangle(img, LDrawTri(quad.color, quad.position1, quad.position2, quad.position3));
-    fillTriangle(img, LDrawTri(quad.color, quad.position3, quad.position4, quad.position1));
+static void writeProfile(const std::string& profile_path, const std::string& profile_trace_path) {
+    if (!profile_path.empty() && !Profiler::writeReport(profile_path)) {
+        std::cerr << "Failed to save profile." << std::endl;
+    }
+    if (!profile_trace_path.empty() && !Profiler::writeTrace(profile_trace_path)) {
+        std::cerr << "Failed to save profile trace." << std::endl;
+    }
 }
 
-int main() {
-    Image img(1920, 1080);
+int main(int argc, char** argv) {
+    RenderOptions options;
+    std::string library_path = "ldraw";
+    std::string model_path = "model.ldr";
+    std::string output_path = "output.bmp";
+    std::string jobs_path;
+    std::string profile_path;
+    std::string profile_trace_path;
+    bool watch = false;
 
-    LDraw test("ldraw");
-    test.loadFromFile("model.ldr");
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--library" && i + 1 < argc) {
+            library_path = argv[++i];
+        } else if (argument == "--model" && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (argument == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argument == "--jobs" && i + 1 < argc) {
+            jobs_path = argv[++i];
+        } else if (argument == "--visibility") {
+            options.visibility = true;
+        } else if (argument == "--id-map" && i + 1 < argc) {
+            options.visibility = true;
+            options.id_map_path = argv[++i];
+        } else if (argument == "--id-table" && i + 1 < argc) {
+            options.id_table_path = argv[++i];
+        } else if (argument == "--flat-shading") {
+            options.flat_shading = true;
+        } else if (argument == "--width" && i + 1 < argc && Utilities::parseNumber(argv[i + 1], options.width)) {
+            ++i;
+        } else if (argument == "--height" && i + 1 < argc && Utilities::parseNumber(argv[i + 1], options.height)) {
+            ++i;
+        } else if (argument == "--tiled") {
+            options.tiled = true;
+        } else if (argument == "--memory-budget" && i + 1 < argc && Utilities::parseNumber(argv[i + 1], options.memory_budget)) {
+            options.tiled = true;
+            ++i;
+        } else if (argument == "--watch") {
+            watch = true;
+        } else if (argument == "--profile" && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (argument == "--profile-trace" && i + 1 < argc) {
+            profile_trace_path = argv[++i];
+        } else if (argument == "--loader" && i + 1 < argc) {
+            std::string loader = argv[++i];
+            if (loader == "serial") {
+                LDraw::setLoaderType(LoaderType::SERIAL);
+            } else if (loader == "threads") {
+                LDraw::setLoaderType(LoaderType::THREAD_POOL);
+            } else if (loader == "io_uring") {
+                LDraw::setLoaderType(LoaderType::IO_URING);
+            } else {
+                printUsage();
+                return 1;
+            }
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
 
-    for (LDrawLine line : test.buildLines()) {
-        drawLine(img, line.position1.x + 50, line.position1.y + 250, line.position1.z, line.position2.x + 50, line.position2.y + 250, line.position2.z, line.color->edge);
+    // the id map, its table and watching only make sense for a single model
+    if (options.width <= 0 || options.height <= 0 || (!jobs_path.empty() && (!options.id_map_path.empty() || !options.id_table_path.empty() || watch))) {
+        printUsage();
+        return 1;
     }
 
-    for (LDrawTri tri : test.buildTris()) {
-        tri.position1.x += 50;
-        tri.position2.x += 50;
-        tri.position3.x += 50;
+    Profiler::setEnabled(!profile_path.empty() || !profile_trace_path.empty());
 
-        tri.position1.y += 250;
-        tri.position2.y += 250;
-        tri.position3.y += 250;
-        fillTriangle(img, tri);
+    Engine engine(library_path);
+    if (!engine.isReady()) {
+        std::cerr << "Failed to load library." << std::endl;
+        return 1;
     }
 
-    for (LDrawQuad quad : test.buildQuads()) {
-        quad.position1.x += 50;
-        quad.position2.x += 50;
-        quad.position3.x += 50;
-        quad.position4.x += 50;
+    if (!jobs_path.empty()) {
+        std::vector<JobEntry> entries;
+        if (!readJobList(jobs_path, options, entries)) {
+            std::cerr << "Failed to read job list." << std::endl;
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t saved_count = renderJobList(engine, entries, options);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Rendered " << saved_count << " of " << entries.size() << " models in " << elapsed.count() << " ms" << std::endl;
 
-        quad.position1.y += 250;
-        quad.position2.y += 250;
-        quad.position3.y += 250;
-        quad.position4.y += 250;
+        writeProfile(profile_path, profile_trace_path);
 
-        fillQuad(img, quad);
+        return saved_count == entries.size() ? 0 : 1;
     }
 
-    if (img.saveBMP("output.bmp")) {
+    auto load_start = std::chrono::steady_clock::now();
+    LDraw test(library_path);
+    test.loadFromFile(model_path);
+    auto load_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - load_start);
+    std::cout << "Model loaded in " << load_elapsed.count() << " ms" << std::endl;
+
+    if (renderModel(engine, test, output_path, options)) {
         std::cout << "File saved successfully!" << std::endl;
     } else {
         std::cerr << "Failed to save file." << std::endl;
     }
 
+    writeProfile(profile_path, profile_trace_path);
+
+    // in watch mode the report is rewritten for every re-render, dropping what came before keeps memory bounded
+    while (watch) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        Profiler::reset();
+
+        auto start = std::chrono::steady_clock::now();
+        if (!test.reload()) {
+            continue;
+        }
+
+        bool saved = renderModel(engine, test, output_path, options);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        if (saved) {
+            std::cout << "File updated in " << elapsed.count() << " ms" << std::endl;
+        } else {
+            std::cerr << "Failed to save file." << std::endl;
+        }
+        writeProfile(profile_path, profile_trace_path);
+    }
+
     return 0;
 }
@@ -0,0 +1,214 @@
+// codeshaunted - ldrender
+// source/ldrender/profiler.cc
+// contains Profiler definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "profiler.hh"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ldrender {
+
+static const char* COUNTER_NAMES[] = {
+    "files_opened",
+    "files_failed",
+    "archive_entries_read",
+    "bytes_read",
+    "lines_parsed",
+    "subfile_primitives",
+    "line_primitives",
+    "tri_primitives",
+    "quad_primitives",
+    "pixels_tested",
+    "pixels_written",
+    "pixels_overwritten"
+};
+
+static_assert(std::size(COUNTER_NAMES) == static_cast<size_t>(ProfileCounter::COUNT));
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct ThreadEvents {
+    uint32_t thread_id;
+    std::vector<ProfileEvent> events;
+};
+
+// buffers are owned here rather than by the threads so events survive short lived worker threads
+static std::mutex thread_events_mutex;
+static std::vector<std::unique_ptr<ThreadEvents>> thread_events;
+static std::atomic<uint64_t> thread_events_generation = 0; // bumped by reset so threads drop their freed buffer
+static std::atomic<uint64_t> counters[static_cast<size_t>(ProfileCounter::COUNT)];
+static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static ThreadEvents& getThreadEvents() {
+    thread_local ThreadEvents* events = nullptr;
+    thread_local uint64_t events_generation = 0;
+    uint64_t generation = thread_events_generation.load(std::memory_order_acquire);
+    if (!events || events_generation != generation) {
+        std::lock_guard<std::mutex> lock(thread_events_mutex);
+        thread_events.push_back(std::make_unique<ThreadEvents>());
+        events = thread_events.back().get();
+        events->thread_id = thread_events.size();
+        events_generation = generation;
+    }
+
+    return *events;
+}
+
+bool Profiler::enabled = false;
+
+void Profiler::setEnabled(bool enabled) {
+    if (enabled && !Profiler::enabled) {
+        epoch = std::chrono::steady_clock::now();
+    }
+    Profiler::enabled = enabled;
+}
+
+bool Profiler::isEnabled() {
+    return Profiler::enabled;
+}
+
+void Profiler::reset() {
+    {
+        std::lock_guard<std::mutex> lock(thread_events_mutex);
+        thread_events.clear();
+        thread_events_generation.fetch_add(1, std::memory_order_release);
+    }
+    for (std::atomic<uint64_t>& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    epoch = std::chrono::steady_clock::now();
+}
+
+void Profiler::addCounter(ProfileCounter counter, uint64_t value) {
+    if (Profiler::enabled) {
+        counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Profiler::getCounter(ProfileCounter counter) {
+    return counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+bool Profiler::writeReport(const std::string& file_name) {
+    struct Phase {
+        uint64_t count = 0;
+        uint64_t total = 0;
+        uint64_t max = 0;
+    };
+
+    std::map<std::string, Phase> phases;
+    {
+        std::lock_guard<std::mutex> lock(thread_events_mutex);
+        for (auto& events : thread_events) {
+            for (const ProfileEvent& event : events->events) {
+                Phase& phase = phases[event.name];
+                uint64_t duration = event.end - event.start;
+                ++phase.count;
+                phase.total += duration;
+                phase.max = std::max(phase.max, duration);
+            }
+        }
+    }
+
+    std::ofstream file(file_name);
+    if (!file) return false;
+
+    file << "{\n";
+    file << "  \"wall_ms\": " << Profiler::now() / 1e6 << ",\n";
+    file << "  \"phases\": {";
+    bool first = true;
+    for (auto& [name, phase] : phases) {
+        file << (first ? "\n" : ",\n");
+        file << "    \"" << name << "\": {\"count\": " << phase.count << ", \"total_ms\": " << phase.total / 1e6 << ", \"max_ms\": " << phase.max / 1e6 << "}";
+        first = false;
+    }
+    file << "\n  },\n";
+
+    file << "  \"counters\": {\n";
+    for (size_t i = 0; i < std::size(COUNTER_NAMES); ++i) {
+        file << "    \"" << COUNTER_NAMES[i] << "\": " << counters[i].load(std::memory_order_relaxed);
+        file << (i + 1 < std::size(COUNTER_NAMES) ? ",\n" : "\n");
+    }
+    file << "  },\n";
+
+    // overdraw is writes per pixel that ended up covered
+    uint64_t pixels_written = Profiler::getCounter(ProfileCounter::PIXELS_WRITTEN);
+    uint64_t pixels_covered = pixels_written - Profiler::getCounter(ProfileCounter::PIXELS_OVERWRITTEN);
+    file << "  \"overdraw\": " << (pixels_covered ? static_cast<double>(pixels_written) / pixels_covered : 0.0) << "\n";
+    file << "}\n";
+
+    return file.good();
+}
+
+bool Profiler::writeTrace(const std::string& file_name) {
+    std::ofstream file(file_name);
+    if (!file) return false;
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lock(thread_events_mutex);
+        for (auto& events : thread_events) {
+            for (const ProfileEvent& event : events->events) {
+                file << (first ? "" : ",\n");
+                file << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << events->thread_id;
+                file << ", \"ts\": " << event.start / 1e3 << ", \"dur\": " << (event.end - event.start) / 1e3 << "}";
+                first = false;
+            }
+        }
+    }
+
+    // counter totals as a single sample at the end of the timeline
+    file << (first ? "" : ",\n") << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << Profiler::now() / 1e3 << ", \"args\": {";
+    for (size_t i = 0; i < std::size(COUNTER_NAMES); ++i) {
+        file << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << counters[i].load(std::memory_order_relaxed);
+    }
+    file << "}}\n]}\n";
+
+    return file.good();
+}
+
+uint64_t Profiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::addEvent(const char* name, uint64_t start, uint64_t end) {
+    getThreadEvents().events.push_back({name, start, end});
+}
+
+ProfileScope::ProfileScope(const char* name) : name(name), start(0), active(Profiler::enabled) {
+    if (this->active) {
+        this->start = Profiler::now();
+    }
+}
+
+ProfileScope::~ProfileScope() {
+    if (this->active) {
+        Profiler::addEvent(this->name, this->start, Profiler::now());
+    }
+}
+
+} // namespace ldrender
@@ -0,0 +1,363 @@
+// codeshaunted - ldrender
+// source/ldrender/renderer.cc
+// contains Renderer definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "renderer.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "profiler.hh"
+
+namespace ldrender {
+
+Renderer::Renderer(std::vector<LDrawLine> lines, std::vector<LDrawTri> tris, std::vector<LDrawQuad> quads) : lines(std::move(lines)), tris(std::move(tris)), quads(std::move(quads)) {
+    this->thread_count = std::max(1u, std::thread::hardware_concurrency());
+    this->buildPalette();
+}
+
+void Renderer::translate(float x, float y) {
+    for (LDrawLine& line : this->lines) {
+        line.position1.x += x;
+        line.position2.x += x;
+
+        line.position1.y += y;
+        line.position2.y += y;
+    }
+
+    for (LDrawTri& tri : this->tris) {
+        tri.position1.x += x;
+        tri.position2.x += x;
+        tri.position3.x += x;
+
+        tri.position1.y += y;
+        tri.position2.y += y;
+        tri.position3.y += y;
+    }
+
+    for (LDrawQuad& quad : this->quads) {
+        quad.position1.x += x;
+        quad.position2.x += x;
+        quad.position3.x += x;
+        quad.position4.x += x;
+
+        quad.position1.y += y;
+        quad.position2.y += y;
+        quad.position3.y += y;
+        quad.position4.y += y;
+    }
+}
+
+void Renderer::setFlatShading(bool flat_shading) {
+    if (this->flat_shading != flat_shading) {
+        this->flat_shading = flat_shading;
+        this->buildPalette();
+    }
+}
+
+void Renderer::setThreadCount(unsigned int thread_count) {
+    this->thread_count = std::max(1u, thread_count);
+}
+
+size_t Renderer::getPrimitiveCount() {
+    return this->palette.size();
+}
+
+void Renderer::renderForward(Image& image) {
+    ProfileScope scope("rasterize");
+
+    this->rasterize(image, false);
+    image.flushProfileCounters();
+}
+
+void Renderer::renderVisibility(Image& image) {
+    ProfileScope scope("rasterize_ids");
+
+    this->rasterize(image, true);
+    image.flushProfileCounters();
+}
+
+void Renderer::resolve(const uint32_t* ids, uint32_t* colors, size_t count) {
+    ProfileScope scope("resolve");
+
+    auto resolve_range = [this, ids, colors](size_t begin, size_t end) {
+        const uint32_t* palette = this->palette.data();
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t id = ids[i];
+            colors[i] = id == NO_PRIMITIVE ? 0 : palette[id];
+        }
+    };
+
+    size_t chunk_count = std::min<size_t>(this->thread_count, count / 4096 + 1);
+    if (chunk_count <= 1) {
+        resolve_range(0, count);
+        return;
+    }
+
+    size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+    std::vector<std::thread> threads;
+    for (size_t begin = 0; begin < count; begin += chunk_size) {
+        threads.emplace_back(resolve_range, begin, std::min(begin + chunk_size, count));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+static uint32_t shadeColor(uint32_t color, const Vector3& position1, const Vector3& position2, const Vector3& position3) {
+    float ux = position2.x - position1.x, uy = position2.y - position1.y, uz = position2.z - position1.z;
+    float vx = position3.x - position1.x, vy = position3.y - position1.y, vz = position3.z - position1.z;
+    float nx = uy * vz - uz * vy;
+    float ny = uz * vx - ux * vz;
+    float nz = ux * vy - uy * vx;
+    float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+    if (length == 0.0f) {
+        return color;
+    }
+
+    // simple headlight, faces pointing at the viewer keep their full color
+    float intensity = 0.4f + 0.6f * std::abs(nz) / length;
+    uint32_t r = ((color >> 16) & 0xFF) * intensity;
+    uint32_t g = ((color >> 8) & 0xFF) * intensity;
+    uint32_t b = (color & 0xFF) * intensity;
+
+    return (color & 0xFF000000) | (r << 16) | (g << 8) | b;
+}
+
+void Renderer::buildPalette() {
+    this->palette.clear();
+    this->palette.reserve(this->lines.size() + this->tris.size() + this->quads.size());
+
+    for (const LDrawLine& line : this->lines) {
+        this->palette.push_back(line.color ? line.color->edge : 0);
+    }
+
+    for (const LDrawTri& tri : this->tris) {
+        uint32_t color = tri.color ? tri.color->main : 0;
+        if (this->flat_shading) {
+            color = shadeColor(color, tri.position1, tri.position2, tri.position3);
+        }
+        this->palette.push_back(color);
+    }
+
+    for (const LDrawQuad& quad : this->quads) {
+        uint32_t color = quad.color ? quad.color->main : 0;
+        if (this->flat_shading) {
+            color = shadeColor(color, quad.position1, quad.position2, quad.position3);
+        }
+        this->palette.push_back(color);
+    }
+}
+
+bool Renderer::renderTiled(int width, int height, size_t memory_budget, bool visibility, BMPWriter& output, BMPWriter* id_output) {
+    ProfileScope scope("render_tiled");
+
+    // depth and pixel value per pixel
+    size_t row_size = static_cast<size_t>(width) * (sizeof(float) + sizeof(uint32_t));
+    int band_height = std::clamp<size_t>(memory_budget / row_size, 1, height);
+    int band_count = (height + band_height - 1) / band_height;
+
+    // bands are swept bottom up, so primitives start touching them in order of their lowest row (largest y),
+    // a primitive is only held while it overlaps the current band, which keeps this independent of the resolution
+    std::vector<std::pair<int, uint32_t>> primitive_order; // max_y, id
+    primitive_order.reserve(this->palette.size());
+    for (uint32_t id = 0; id < this->palette.size(); ++id) {
+        int min_y, max_y;
+        this->getPrimitiveRows(id, min_y, max_y);
+        if (max_y >= 0 && min_y < height) {
+            primitive_order.push_back({max_y, id});
+        }
+    }
+    std::sort(primitive_order.begin(), primitive_order.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+    size_t next_primitive = 0;
+    std::vector<uint32_t> active_primitives; // kept in draw order so depth ties resolve the same way
+
+    uint32_t clear_value = visibility ? NO_PRIMITIVE : 0;
+    Image band_image(width, band_height, clear_value);
+
+    // BMP rows are bottom up, so start with the last band
+    for (int band = band_count - 1; band >= 0; --band) {
+        int origin_y = band * band_height;
+        int rows = std::min(band_height, height - origin_y);
+        band_image.clear(clear_value, origin_y);
+
+        {
+            ProfileScope band_scope(visibility ? "rasterize_ids" : "rasterize");
+
+            size_t entered = active_primitives.size();
+            for (; next_primitive < primitive_order.size() && primitive_order[next_primitive].first >= origin_y; ++next_primitive) {
+                active_primitives.push_back(primitive_order[next_primitive].second);
+            }
+            std::sort(active_primitives.begin() + entered, active_primitives.end());
+            std::inplace_merge(active_primitives.begin(), active_primitives.begin() + entered, active_primitives.end());
+
+            // primitives entirely below this band are done, every band after it is higher up
+            int band_end = origin_y + rows - 1;
+            std::erase_if(active_primitives, [this, band_end](uint32_t id) {
+                int min_y, max_y;
+                this->getPrimitiveRows(id, min_y, max_y);
+                return min_y > band_end;
+            });
+
+            for (uint32_t id : active_primitives) {
+                this->rasterizePrimitive(band_image, id, visibility);
+            }
+            band_image.flushProfileCounters();
+        }
+
+        uint32_t* pixels = band_image.getPixels();
+        if (visibility) {
+            if (id_output) {
+                for (int y = rows - 1; y >= 0; --y) {
+                    if (!id_output->writeRow(&pixels[y * width])) {
+                        return false;
+                    }
+                }
+            }
+            this->resolve(pixels, pixels, static_cast<size_t>(rows) * width);
+        }
+
+        ProfileScope write_scope("write_rows");
+        for (int y = rows - 1; y >= 0; --y) {
+            if (!output.writeRow(&pixels[y * width])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void Renderer::rasterize(Image& image, bool write_ids) {
+    for (uint32_t id = 0; id < this->palette.size(); ++id) {
+        this->rasterizePrimitive(image, id, write_ids);
+    }
+}
+
+void Renderer::rasterizePrimitive(Image& image, uint32_t id, bool write_ids) {
+    uint32_t value = write_ids ? id : this->palette[id];
+
+    if (id < this->lines.size()) {
+        const LDrawLine& line = this->lines[id];
+        this->drawLine(image, line.position1, line.position2, value);
+        return;
+    }
+    id -= this->lines.size();
+
+    if (id < this->tris.size()) {
+        const LDrawTri& tri = this->tris[id];
+        this->fillTriangle(image, tri.position1, tri.position2, tri.position3, value);
+        return;
+    }
+    id -= this->tris.size();
+
+    const LDrawQuad& quad = this->quads[id];
+    this->fillTriangle(image, quad.position1, quad.position2, quad.position3, value);
+    this->fillTriangle(image, quad.position3, quad.position4, quad.position1, value);
+}
+
+void Renderer::getPrimitiveRows(uint32_t id, int& min_y, int& max_y) {
+    // same float to int truncation the rasterizers use
+    if (id < this->lines.size()) {
+        const LDrawLine& line = this->lines[id];
+        min_y = std::min<int>(line.position1.y, line.position2.y);
+        max_y = std::max<int>(line.position1.y, line.position2.y);
+        return;
+    }
+    id -= this->lines.size();
+
+    if (id < this->tris.size()) {
+        const LDrawTri& tri = this->tris[id];
+        min_y = std::min({tri.position1.y, tri.position2.y, tri.position3.y});
+        max_y = std::max({tri.position1.y, tri.position2.y, tri.position3.y});
+        return;
+    }
+    id -= this->tris.size();
+
+    const LDrawQuad& quad = this->quads[id];
+    min_y = std::min({quad.position1.y, quad.position2.y, quad.position3.y, quad.position4.y});
+    max_y = std::max({quad.position1.y, quad.position2.y, quad.position3.y, quad.position4.y});
+}
+
+void Renderer::drawLine(Image& image, const Vector3& position1, const Vector3& position2, uint32_t value) {
+    int x0 = position1.x, y0 = position1.y, x1 = position2.x, y1 = position2.y;
+    float z0 = position1.z, z1 = position2.z;
+
+    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+
+    if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        std::swap(z0, z1); // swap z values accordingly
+    }
+
+    int dx = x1 - x0;
+    int dy = std::abs(y1 - y0);
+    float dz = (z1 - z0) / static_cast<float>(dx);
+    int error = dx / 2;
+    int ystep = (y0 < y1) ? 1 : -1;
+    int y = y0;
+    float z = z0;
+
+    for (int x = x0; x <= x1; x++) {
+        if (steep) {
+            image.setPixel(y, x, z, value);
+        } else {
+            image.setPixel(x, y, z, value);
+        }
+        error -= dy;
+        z += dz; // increment z along the line
+        if (error < 0) {
+            y += ystep;
+            error += dx;
+        }
+    }
+}
+
+void Renderer::fillTriangle(Image& image, const Vector3& position1, const Vector3& position2, const Vector3& position3, uint32_t value) {
+    // find bounding box, clipped to the image since setPixel would reject anything outside anyways
+    int min_x = std::max<int>(std::min({position1.x, position2.x, position3.x}), 0);
+    int min_y = std::max<int>(std::min({position1.y, position2.y, position3.y}), image.getOriginY());
+    int max_x = std::min<int>(std::max({position1.x, position2.x, position3.x}), image.getWidth() - 1);
+    int max_y = std::min<int>(std::max({position1.y, position2.y, position3.y}), image.getOriginY() + image.getHeight() - 1);
+
+    float denominator = (position2.y - position3.y) * (position1.x - position3.x) + (position3.x - position2.x) * (position1.y - position3.y);
+
+    // iterate over pixels in the bounding box
+    for (int y = min_y; y <= max_y; y++) {
+        for (int x = min_x; x <= max_x; x++) {
+            // barycentric coordinates to determine if point is inside the triangle
+            float alpha = ((position2.y - position3.y) * (x - position3.x) + (position3.x - position2.x) * (y - position3.y)) / denominator;
+            float beta = ((position3.y - position1.y) * (x - position3.x) + (position1.x - position3.x) * (y - position3.y)) / denominator;
+            float gamma = 1.0f - alpha - beta;
+
+            if (alpha >= 0 && beta >= 0 && gamma >= 0) {
+                // interpolate z value
+                float z = alpha * position1.z + beta * position2.z + gamma * position3.z;
+                image.setPixel(x, y, z, value);
+            }
+        }
+    }
+}
+
+} // namespace ldrender
@@ -0,0 +1,158 @@
+// codeshaunted - ldrender
+// source/ldrender_bench/generator.cc
+// contains synthetic LDraw generator definitions
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include "generator.hh"
+
+#include <fstream>
+#include <sstream>
+
+namespace ldrender {
+
+// every generated subfile reference uses one of these so the transformed geometry stays inside its part
+static const char* ORIENTATIONS[] = {
+    "1 0 0 0 1 0 0 0 1",
+    "0 0 1 0 1 0 -1 0 0",
+    "-1 0 0 0 1 0 0 0 -1",
+    "0 1 0 -1 0 0 0 0 1"
+};
+
+static const int COLOR_CODES[] = {0, 1, 2, 4, 14, 15, 16};
+
+Generator::Generator(GeneratorOptions options) : options(options), random(options.seed) {}
+
+bool Generator::writeLibrary(const std::filesystem::path& library_path) {
+    std::error_code error;
+    std::filesystem::create_directories(library_path / "parts", error);
+    std::filesystem::create_directories(library_path / "p", error);
+    if (error) {
+        return false;
+    }
+
+    auto write_file = [](const std::filesystem::path& path, const std::string& data) {
+        std::ofstream file(path, std::ios::binary);
+        file << data;
+        return file.good();
+    };
+
+    if (!write_file(library_path / "LDConfig.ldr", this->generateConfig())) {
+        return false;
+    }
+
+    // level 0 holds the actual geometry, every level above only references the one below it
+    for (int level = 0; level < this->options.nesting_depth; ++level) {
+        for (int i = 0; i < this->options.files_per_level; ++i) {
+            std::string data = level == 0 ? this->generateGeometryFile() : this->generateReferenceFile(level);
+            if (!write_file(library_path / "p" / ("level" + std::to_string(level) + "_" + std::to_string(i) + ".dat"), data)) {
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < this->options.part_count; ++i) {
+        if (!write_file(library_path / "parts" / ("part" + std::to_string(i) + ".dat"), this->generatePart())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string Generator::generateModel(int width, int height) {
+    std::stringstream model;
+    std::uniform_int_distribution<int> submodel_distribution(0, this->options.submodel_count - 1);
+    std::uniform_int_distribution<int> part_distribution(0, this->options.part_count - 1);
+    std::uniform_int_distribution<int> color_distribution(0, std::size(COLOR_CODES) - 1);
+
+    model << "0 FILE main.ldr\n";
+    model << "0 Synthetic benchmark model\n";
+    for (int i = 0; i < this->options.submodel_count; ++i) {
+        model << "1 16 " << this->randomFloat(0, width * 0.8f) << " " << this->randomFloat(0, height * 0.6f) << " " << this->randomFloat(-100, 100) << " 1 0 0 0 1 0 0 0 1 submodel" << i << ".ldr\n";
+    }
+
+    for (int i = 0; i < this->options.submodel_count; ++i) {
+        model << "\n0 FILE submodel" << i << ".ldr\n";
+        for (int j = 0; j < this->options.parts_per_submodel; ++j) {
+            model << "1 " << COLOR_CODES[color_distribution(this->random)] << " " << this->randomFloat(0, width * 0.2f) << " " << this->randomFloat(-height * 0.25f, height * 0.15f) << " " << this->randomFloat(-100, 100) << " " << ORIENTATIONS[j % std::size(ORIENTATIONS)] << " part" << part_distribution(this->random) << ".dat\n";
+        }
+    }
+
+    return model.str();
+}
+
+float Generator::randomFloat(float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(this->random);
+}
+
+std::string Generator::generateConfig() {
+    return
+        "0 LDraw.org Configuration File\n"
+        "0 !COLOUR Black CODE 0 VALUE #1B2A34 EDGE #808080\n"
+        "0 !COLOUR Blue CODE 1 VALUE #1E5AA8 EDGE #333333\n"
+        "0 !COLOUR Green CODE 2 VALUE #00852B EDGE #333333\n"
+        "0 !COLOUR Red CODE 4 VALUE #B40000 EDGE #333333\n"
+        "0 !COLOUR Yellow CODE 14 VALUE #FAC80A EDGE #333333\n"
+        "0 !COLOUR White CODE 15 VALUE #F4F4F4 EDGE #333333\n"
+        "0 !COLOUR Main_Colour CODE 16 VALUE #FFFF80 EDGE #333333\n"
+        "0 !COLOUR Edge_Colour CODE 24 VALUE #7F7F7F EDGE #333333\n";
+}
+
+std::string Generator::generateGeometryFile() {
+    std::stringstream file;
+    file << "0 Synthetic primitive\n";
+    for (int i = 0; i < this->options.triangles_per_file; ++i) {
+        float x = this->randomFloat(-8, 8), y = this->randomFloat(-8, 8), z = this->randomFloat(-8, 8);
+        if (i % 2 == 0) {
+            file << "3 16 " << x << " " << y << " " << z << " " << x + this->randomFloat(-4, 4) << " " << y + this->randomFloat(-4, 4) << " " << z << " " << x + this->randomFloat(-4, 4) << " " << y + this->randomFloat(-4, 4) << " " << z << "\n";
+        } else {
+            // two triangles worth of quad
+            float size = this->randomFloat(1, 4);
+            file << "4 16 " << x << " " << y << " " << z << " " << x + size << " " << y << " " << z << " " << x + size << " " << y + size << " " << z << " " << x << " " << y + size << " " << z << "\n";
+            ++i;
+        }
+        file << "2 24 " << x << " " << y << " " << z << " " << x + this->randomFloat(-4, 4) << " " << y + this->randomFloat(-4, 4) << " " << z << "\n";
+    }
+
+    return file.str();
+}
+
+std::string Generator::generateReferenceFile(int level) {
+    std::stringstream file;
+    std::uniform_int_distribution<int> file_distribution(0, this->options.files_per_level - 1);
+
+    file << "0 Synthetic level " << level << " primitive\n";
+    for (int i = 0; i < 2; ++i) {
+        file << "1 16 " << i * 4 << " 0 0 " << ORIENTATIONS[i] << " level" << level - 1 << "_" << file_distribution(this->random) << ".dat\n";
+    }
+
+    return file.str();
+}
+
+std::string Generator::generatePart() {
+    std::stringstream file;
+    int top_level = this->options.nesting_depth - 1;
+    std::uniform_int_distribution<int> file_distribution(0, this->options.files_per_level - 1);
+
+    file << "0 Synthetic part\n";
+    for (int i = 0; i < 3; ++i) {
+        file << "1 16 " << i * 6 << " " << i * -2 << " 0 " << ORIENTATIONS[(i + 1) % std::size(ORIENTATIONS)] << " level" << top_level << "_" << file_distribution(this->random) << ".dat\n";
+    }
+    file << "4 16 -10 -10 0 10 -10 0 10 10 0 -10 10 0\n";
+
+    return file.str();
+}
+
+} // namespace ldrender
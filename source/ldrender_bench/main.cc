@@ -0,0 +1,392 @@
+// codeshaunted - ldrender
+// source/ldrender_bench/main.cc
+// contains benchmark entry point
+// Copyright 2024 codeshaunted
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org / licenses / LICENSE - 2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissionsand
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "generator.hh"
+#include "image.hh"
+#include "ldraw.hh"
+#include "renderer.hh"
+#include "utilities.hh"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace ldrender;
+
+struct BenchmarkResult {
+    std::string name;
+    std::string unit; // what items counts
+    size_t items = 0;
+    std::vector<double> times_ms;
+};
+
+// setup runs before every iteration and is not timed, run returns the number of items it processed
+static BenchmarkResult runBenchmark(const std::string& name, const std::string& unit, int iterations, std::function<void()> setup, std::function<size_t()> run) {
+    BenchmarkResult result;
+    result.name = name;
+    result.unit = unit;
+
+    std::cerr << "running " << name << std::flush;
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        result.items = run();
+        result.times_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        std::cerr << "." << std::flush;
+    }
+    std::cerr << std::endl;
+
+    return result;
+}
+
+static void writeResults(std::ostream& output, const GeneratorOptions& options, int iterations, int width, int height, bool cold_cache, const std::vector<BenchmarkResult>& results) {
+    output << "{\n";
+    output << "  \"benchmark\": \"ldrender_bench\",\n";
+    output << "  \"config\": {\n";
+    output << "    \"part_count\": " << options.part_count << ",\n";
+    output << "    \"nesting_depth\": " << options.nesting_depth << ",\n";
+    output << "    \"files_per_level\": " << options.files_per_level << ",\n";
+    output << "    \"triangles_per_file\": " << options.triangles_per_file << ",\n";
+    output << "    \"submodel_count\": " << options.submodel_count << ",\n";
+    output << "    \"parts_per_submodel\": " << options.parts_per_submodel << ",\n";
+    output << "    \"seed\": " << options.seed << ",\n";
+    output << "    \"iterations\": " << iterations << ",\n";
+    output << "    \"width\": " << width << ",\n";
+    output << "    \"height\": " << height << ",\n";
+    output << "    \"cold_cache\": " << (cold_cache ? "true" : "false") << "\n";
+    output << "  },\n";
+    output << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        std::vector<double> sorted_times = result.times_ms;
+        std::sort(sorted_times.begin(), sorted_times.end());
+        double mean = 0.0;
+        for (double time : sorted_times) {
+            mean += time;
+        }
+        mean /= sorted_times.size();
+        double median = sorted_times[sorted_times.size() / 2];
+
+        output << "    {\"name\": \"" << result.name << "\", \"unit\": \"" << result.unit << "\", \"items\": " << result.items;
+        output << ", \"min_ms\": " << sorted_times.front() << ", \"median_ms\": " << median << ", \"mean_ms\": " << mean << ", \"max_ms\": " << sorted_times.back();
+        output << ", \"items_per_second\": " << (median > 0.0 ? result.items / (median / 1000.0) : 0.0) << "}";
+        output << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    output << "  ]\n";
+    output << "}\n";
+}
+
+// drops the file contents from the page cache so the next load has to go to the disk,
+// directory entries and inodes stay cached, returns false if this isn't supported here
+static bool evictFromPageCache(const std::filesystem::path& path) {
+#ifndef _WIN32
+    std::error_code error;
+    std::vector<std::filesystem::path> files;
+    if (std::filesystem::is_directory(path, error)) {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path, error)) {
+            if (entry.is_regular_file(error)) {
+                files.push_back(entry.path());
+            }
+        }
+    } else {
+        files.push_back(path);
+    }
+
+    for (const std::filesystem::path& file : files) {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        // dirty pages are not dropped, freshly generated files have to reach the disk first
+        bool evicted = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(fd);
+        if (!evicted) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+// a fresh directory so concurrent runs never share files, empty path on failure
+static std::filesystem::path createTemporaryDirectory() {
+    std::random_device random;
+    std::error_code error;
+    std::filesystem::path temporary_path = std::filesystem::temp_directory_path(error);
+    for (int attempt = 0; attempt < 100 && !error; ++attempt) {
+        std::stringstream name;
+        name << "ldrender_bench_" << std::hex << random() << random();
+        if (std::filesystem::create_directory(temporary_path / name.str(), error)) {
+            return temporary_path / name.str();
+        }
+    }
+
+    return {};
+}
+
+static void printUsage() {
+    std::cerr << "usage: ldrender_bench [options]" << std::endl;
+    std::cerr << "  --parts <count>               parts in the synthetic library (default 500)" << std::endl;
+    std::cerr << "  --depth <levels>              nesting depth below each part (default 3)" << std::endl;
+    std::cerr << "  --files-per-level <count>     primitive files per nesting level (default 50)" << std::endl;
+    std::cerr << "  --triangles <count>           triangles per innermost file (default 24)" << std::endl;
+    std::cerr << "  --submodels <count>           0 FILE sections in the model (default 20)" << std::endl;
+    std::cerr << "  --parts-per-submodel <count>  part references per section (default 100)" << std::endl;
+    std::cerr << "  --seed <seed>                 generator seed (default 1)" << std::endl;
+    std::cerr << "  --iterations <count>          timed runs per benchmark (default 5)" << std::endl;
+    std::cerr << "  --width <pixels>              render width (default 1920)" << std::endl;
+    std::cerr << "  --height <pixels>             render height (default 1080)" << std::endl;
+    std::cerr << "  --work-dir <path>             where the synthetic library is written (default a new temporary directory)" << std::endl;
+    std::cerr << "  --output <file>               write the JSON results here instead of stdout" << std::endl;
+    std::cerr << "  --cold-cache                  evict the library from the page cache before every load iteration" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    GeneratorOptions options;
+    int iterations = 5;
+    int width = 1920;
+    int height = 1080;
+    std::filesystem::path work_path;
+    std::string output_path;
+    bool cold_cache = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--cold-cache") {
+            cold_cache = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printUsage();
+            return 1;
+        }
+
+        if (argument == "--parts" && Utilities::parseNumber(argv[i + 1], options.part_count)) {
+            ++i;
+        } else if (argument == "--depth" && Utilities::parseNumber(argv[i + 1], options.nesting_depth)) {
+            ++i;
+        } else if (argument == "--files-per-level" && Utilities::parseNumber(argv[i + 1], options.files_per_level)) {
+            ++i;
+        } else if (argument == "--triangles" && Utilities::parseNumber(argv[i + 1], options.triangles_per_file)) {
+            ++i;
+        } else if (argument == "--submodels" && Utilities::parseNumber(argv[i + 1], options.submodel_count)) {
+            ++i;
+        } else if (argument == "--parts-per-submodel" && Utilities::parseNumber(argv[i + 1], options.parts_per_submodel)) {
+            ++i;
+        } else if (argument == "--seed" && Utilities::parseNumber(argv[i + 1], options.seed)) {
+            ++i;
+        } else if (argument == "--iterations" && Utilities::parseNumber(argv[i + 1], iterations)) {
+            ++i;
+        } else if (argument == "--width" && Utilities::parseNumber(argv[i + 1], width)) {
+            ++i;
+        } else if (argument == "--height" && Utilities::parseNumber(argv[i + 1], height)) {
+            ++i;
+        } else if (argument == "--work-dir") {
+            work_path = argv[++i];
+        } else if (argument == "--output") {
+            output_path = argv[++i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (options.part_count <= 0 || options.nesting_depth <= 0 || options.files_per_level <= 0 || options.triangles_per_file < 0 || options.submodel_count <= 0 || options.parts_per_submodel < 0 || iterations <= 0 || width <= 0 || height <= 0) {
+        printUsage();
+        return 1;
+    }
+
+    // only what the bench generates is ever removed, a given work dir itself is left alone
+    std::error_code error;
+    bool created_work_path = work_path.empty();
+    if (created_work_path) {
+        work_path = createTemporaryDirectory();
+        if (work_path.empty()) {
+            std::cerr << "Failed to create a temporary directory" << std::endl;
+            return 1;
+        }
+    } else {
+        std::filesystem::create_directories(work_path, error);
+    }
+
+    std::filesystem::path library_path = work_path / "ldraw";
+    std::filesystem::path model_path = work_path / "model.ldr";
+    std::filesystem::path image_path = work_path / "output.bmp";
+    for (const std::filesystem::path& path : {library_path, model_path, image_path}) {
+        if (std::filesystem::exists(path, error)) {
+            std::cerr << "Refusing to overwrite " << path << std::endl;
+            return 1;
+        }
+    }
+
+    auto removeGenerated = [&] {
+        std::filesystem::remove_all(library_path, error);
+        std::filesystem::remove(model_path, error);
+        std::filesystem::remove(image_path, error);
+        if (created_work_path) {
+            std::filesystem::remove(work_path, error);
+        }
+    };
+
+    Generator generator(options);
+    if (!generator.writeLibrary(library_path)) {
+        removeGenerated();
+        std::cerr << "Failed to write synthetic library to " << library_path << std::endl;
+        return 1;
+    }
+    std::string model_data = generator.generateModel(width, height);
+    {
+        std::ofstream model_file(model_path, std::ios::binary);
+        model_file << model_data;
+    }
+
+    std::vector<BenchmarkResult> results;
+    std::unique_ptr<LDraw> model;
+
+    results.push_back(runBenchmark("parse", "bytes", iterations, [&] {
+        model.reset();
+        model = std::make_unique<LDraw>(library_path.string());
+    }, [&] {
+        model->loadFromData(model_data);
+        return model_data.size();
+    }));
+
+    struct Loader {
+        const char* name;
+        LoaderType type;
+    };
+    for (Loader loader : {Loader{"load_serial", LoaderType::SERIAL}, Loader{"load_threads", LoaderType::THREAD_POOL}, Loader{"load_io_uring", LoaderType::IO_URING}}) {
+        results.push_back(runBenchmark(loader.name, "files", iterations, [&] {
+            model.reset();
+            LDraw::unloadLibrary(); // parts are otherwise still cached from the last iteration
+            LDraw::setLoaderType(loader.type);
+            if (cold_cache && !(evictFromPageCache(library_path) && evictFromPageCache(model_path))) {
+                std::cerr << " (page cache eviction failed)" << std::flush;
+            }
+        }, [&] {
+            model = std::make_unique<LDraw>(library_path.string());
+            model->loadFromFile(model_path.string());
+            return LDraw::getLoadedFileCount(); // only what the model actually references was read
+        }));
+    }
+    LDraw::setLoaderType(LoaderType::IO_URING);
+
+    // what every model after the first one costs when the library stays loaded, as it does in an Engine
+    results.push_back(runBenchmark("load_cached", "models", iterations, [&] {
+        model.reset();
+    }, [&] {
+        model = std::make_unique<LDraw>(library_path.string());
+        model->loadFromFile(model_path.string());
+        return size_t(1);
+    }));
+
+    // flattening caches its result, so every iteration needs a freshly loaded model
+    std::vector<LDrawLine> lines;
+    std::vector<LDrawTri> tris;
+    std::vector<LDrawQuad> quads;
+    results.push_back(runBenchmark("flatten", "primitives", iterations, [&] {
+        model.reset();
+        LDraw::unloadLibrary();
+        model = std::make_unique<LDraw>(library_path.string());
+        model->loadFromFile(model_path.string());
+    }, [&] {
+        lines = model->buildLines();
+        tris = model->buildTris();
+        quads = model->buildQuads();
+        return lines.size() + tris.size() + quads.size();
+    }));
+
+    std::vector<LDrawTri> transformed_tris;
+    results.push_back(runBenchmark("transform", "vertices", iterations, [&] {
+        transformed_tris = tris;
+    }, [&] {
+        TransformMatrix transform(10.0f, 20.0f, 30.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 0.0f);
+        for (LDrawTri& tri : transformed_tris) {
+            tri.position1 = transform * tri.position1;
+            tri.position2 = transform * tri.position2;
+            tri.position3 = transform * tri.position3;
+        }
+        return transformed_tris.size() * 3;
+    }));
+    transformed_tris.clear();
+
+    Renderer renderer(lines, tris, quads);
+    renderer.translate(50, 250);
+    size_t primitive_count = renderer.getPrimitiveCount();
+    std::unique_ptr<Image> image;
+
+    results.push_back(runBenchmark("rasterize_forward", "primitives", iterations, [&] {
+        image = std::make_unique<Image>(width, height);
+    }, [&] {
+        renderer.renderForward(*image);
+        return primitive_count;
+    }));
+
+    results.push_back(runBenchmark("rasterize_visibility", "primitives", iterations, [&] {
+        image = std::make_unique<Image>(width, height, Renderer::NO_PRIMITIVE);
+    }, [&] {
+        renderer.renderVisibility(*image);
+        renderer.resolve(image->getPixels(), image->getPixels(), static_cast<size_t>(width) * height);
+        return primitive_count;
+    }));
+
+    results.push_back(runBenchmark("image_output", "pixels", iterations, [] {}, [&] {
+        image->saveBMP(image_path.string());
+        return static_cast<size_t>(width) * height;
+    }));
+    image.reset();
+
+    results.push_back(runBenchmark("render_tiled", "pixels", iterations, [] {}, [&] {
+        BMPWriter output;
+        output.open(image_path.string(), width, height);
+        renderer.renderTiled(width, height, static_cast<size_t>(width) * 64 * 8, false, output); // 64 row bands
+        output.close();
+        return static_cast<size_t>(width) * height;
+    }));
+
+    model.reset();
+    LDraw::unloadLibrary();
+    removeGenerated();
+
+    if (output_path.empty()) {
+        writeResults(std::cout, options, iterations, width, height, cold_cache, results);
+    } else {
+        std::ofstream output(output_path);
+        writeResults(output, options, iterations, width, height, cold_cache, results);
+        if (!output.good()) {
+            std::cerr << "Failed to write results to " << output_path << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}